@@ -0,0 +1,186 @@
+/*
+ * bench.c - Benchmark harness: estimate the running time of a function
+ *     f as the median of a fixed number of timed repetitions, after a
+ *     number of untimed warmup runs, with a distribution-free confidence
+ *     interval for the median.
+ *
+ * Time is read from the TSC when the processor says it is invariant
+ * (constant rate across P-states and C-states), with its rate calibrated
+ * against CLOCK_MONOTONIC_RAW rather than estimated from sleep().
+ * Otherwise clock_gettime(CLOCK_MONOTONIC_RAW) is used directly.
+ */
+#define _GNU_SOURCE
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+
+/* Default values */
+#define WARMUP 2             /* untimed runs */
+#define REPS 11              /* timed runs */
+#define CALIB_NSECS 20000000 /* length of one TSC calibration interval */
+#define CALIB_ROUNDS 3       /* keep the median of this many */
+#define Z95 1.96             /* normal quantile for a 95% interval */
+
+static int warmup = WARMUP;
+static int reps = REPS;
+
+static int use_tsc = 0;          /* 1 if reading the TSC */
+static double secs_per_tick = 1e-9;
+
+/*
+ * raw_ns - CLOCK_MONOTONIC_RAW in nanoseconds
+ */
+static uint64_t raw_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+
+static inline uint64_t rdtsc(void)
+{
+    unsigned hi, lo;
+    /* lfence keeps earlier instructions from drifting past the read */
+    asm volatile("lfence; rdtsc" : "=a" (lo), "=d" (hi) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/*
+ * tsc_invariant - CPUID.80000007H:EDX[8]
+ */
+static int tsc_invariant(void)
+{
+    unsigned a, b, c, d;
+    if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+        return 0;
+    __cpuid(0x80000007, a, b, c, d);
+    return (d >> 8) & 1;
+}
+#else
+static inline uint64_t rdtsc(void) { return 0; }
+static int tsc_invariant(void) { return 0; }
+#endif
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * bench_init - choose the timer and calibrate the TSC
+ */
+void bench_init(int verbose)
+{
+    use_tsc = tsc_invariant();
+    if (use_tsc) {
+        double rates[CALIB_ROUNDS];
+        int i;
+        for (i = 0; i < CALIB_ROUNDS; i++) {
+            uint64_t t0 = raw_ns(), c0 = rdtsc(), t1, c1;
+            while ((t1 = raw_ns()) - t0 < CALIB_NSECS)
+                ;
+            c1 = rdtsc();
+            rates[i] = (double)(c1 - c0) / (double)(t1 - t0); /* ticks/ns */
+        }
+        qsort(rates, CALIB_ROUNDS, sizeof(double), cmp_double);
+        secs_per_tick = 1e-9 / rates[CALIB_ROUNDS/2];
+    } else {
+        secs_per_tick = 1e-9;
+    }
+    if (verbose) {
+        if (use_tsc)
+            printf("Invariant TSC at %.1f MHz (calibrated against CLOCK_MONOTONIC_RAW)\n",
+                   1e-6 / secs_per_tick);
+        else
+            printf("No invariant TSC; timing with CLOCK_MONOTONIC_RAW\n");
+    }
+}
+
+uint64_t bench_ticks(void)
+{
+    return use_tsc ? rdtsc() : raw_ns();
+}
+
+double bench_ticks_to_secs(double ticks)
+{
+    return ticks * secs_per_tick;
+}
+
+/*
+ * bench - median of reps timed runs of f(argp). The confidence interval
+ *     uses the order statistics whose ranks bracket the median with
+ *     probability ~95% under the binomial distribution, so it does not
+ *     assume the times are normally distributed. With fewer than 6 runs
+ *     that interval would exceed the sample, so min and max are used.
+ */
+double bench(bench_funct f, void *argp, double *lo, double *hi)
+{
+    double samples[reps];
+    double median;
+    int i, j, k;
+
+    for (i = 0; i < warmup; i++)
+        f(argp);
+    for (i = 0; i < reps; i++) {
+        uint64_t t0 = bench_ticks();
+        f(argp);
+        samples[i] = bench_ticks_to_secs(bench_ticks() - t0);
+    }
+    qsort(samples, reps, sizeof(double), cmp_double);
+
+    if (reps % 2)
+        median = samples[reps/2];
+    else
+        median = (samples[reps/2 - 1] + samples[reps/2]) / 2;
+
+    /* 1-based ranks n/2 - z*sqrt(n)/2 and 1 + n/2 + z*sqrt(n)/2,
+       converted to 0-based indices */
+    j = (int)floor(reps/2.0 - Z95*sqrt(reps)/2.0) - 1;
+    k = (int)ceil(reps/2.0 + Z95*sqrt(reps)/2.0);
+    if (j < 0)
+        j = 0;
+    if (k > reps - 1)
+        k = reps - 1;
+    if (lo)
+        *lo = samples[j];
+    if (hi)
+        *hi = samples[k];
+    return median;
+}
+
+/*************************************************************
+ * Set the various parameters used by the harness
+ ************************************************************/
+
+void set_bench_warmup(int n)
+{
+    warmup = n < 0 ? 0 : n;
+}
+
+void set_bench_reps(int n)
+{
+    reps = n < 1 ? 1 : n;
+}
+
+/*
+ * set_bench_cpu - pin to one CPU so that frequency and cache state do
+ *     not change under a run when the scheduler migrates us.
+ *     Return 0 on success, -1 on failure.
+ */
+int set_bench_cpu(int cpu)
+{
+    cpu_set_t set;
+    if (cpu < 0)
+        return 0;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
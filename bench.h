@@ -0,0 +1,41 @@
+/*
+ * bench.h - prototypes for the benchmark harness in bench.c, which
+ *     estimates the running time of a test function f as the median of
+ *     a fixed number of repetitions, with a confidence interval
+ */
+#ifndef __BENCH_H_
+#define __BENCH_H_
+
+#include <stdint.h>
+
+/* The test function takes a generic pointer as input */
+typedef void (*bench_funct)(void *);
+
+/* Calibrate the timer; print what was chosen if verbose */
+void bench_init(int verbose);
+
+/*
+ * Time f(argp): run it warmup times untimed, then reps times timed.
+ * Return the median in seconds and store a 95% confidence interval
+ * for the median in *lo and *hi (either may be NULL).
+ */
+double bench(bench_funct f, void *argp, double *lo, double *hi);
+
+/* Raw timer: ticks and their conversion to seconds */
+uint64_t bench_ticks(void);
+double bench_ticks_to_secs(double ticks);
+
+/*********************************************************
+ * Set the various parameters used by the harness
+ *********************************************************/
+
+/* Untimed runs before measuring. Default = 2 */
+void set_bench_warmup(int n);
+
+/* Timed runs. Default = 11 */
+void set_bench_reps(int n);
+
+/* Pin the calling thread to this CPU; -1 leaves it unpinned (default) */
+int set_bench_cpu(int cpu);
+
+#endif /* __BENCH_H_ */
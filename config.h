@@ -132,10 +132,20 @@
  */
 #define MAX_HEAP (100*(1<<20))  /* 100 MB */
 
+/*
+ * Real-memory heap used by libmm.so (memlib.c built without DRIVER):
+ * address space reserved up front, and the granularity in which it is
+ * committed. mm.c stores free-list links as 32-bit offsets, so the
+ * heap must stay below 2 GB.
+ */
+#define MEM_RESERVE ((size_t)1 << 30)  /* 1 GB */
+#define MEM_SEGMENT (1 << 20)          /* 1 MB */
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   1   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_BENCH  1   /* median of fixed reps w/confidence interval (bench.c) */
+#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
 #define USE_GETTOD 0   /* gettimeofday (any Unix box) */
 
@@ -6,6 +6,7 @@
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
+#include "bench.h"
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
@@ -19,7 +20,11 @@ void init_fsecs(void)
 {
     Mhz = 0; /* keep gcc -Wall happy */
 
-#if USE_FCYC
+#if USE_BENCH
+    if (verbose)
+	printf("Measuring performance with the benchmark harness.\n");
+    bench_init(verbose > 0);
+#elif USE_FCYC
     if (verbose)
 	printf("Measuring performance with a cycle counter.\n");
 
@@ -44,7 +49,9 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
-#if USE_FCYC
+#if USE_BENCH
+    return bench(f, argp, NULL, NULL);
+#elif USE_FCYC
     double cycles = fcyc(f, argp);
     return cycles/(Mhz*1e6);
 #elif USE_ITIMER
@@ -54,4 +61,17 @@ double fsecs(fsecs_test_funct f, void *argp)
 #endif 
 }
 
-
+/*
+ * fsecs_ci - Like fsecs, but also return a 95% confidence interval for
+ *     the running time. Timers without one report lo = hi = the estimate.
+ */
+double fsecs_ci(fsecs_test_funct f, void *argp, double *lo, double *hi)
+{
+#if USE_BENCH
+    return bench(f, argp, lo, hi);
+#else
+    double secs = fsecs(f, argp);
+    *lo = *hi = secs;
+    return secs;
+#endif
+}
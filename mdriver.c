@@ -10,6 +10,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
+#include <math.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -18,11 +19,16 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <dlfcn.h>
+#include <sys/resource.h>
 
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "bench.h"
+#include "perfctr.h"
+#include "mm-module.h"
 #include "config.h"
 
 /**********************
@@ -42,6 +48,10 @@
 #define WALL 1
 #define WUTIL 2
 #define WPERF 3
+
+/* Regression checks against a baseline (-b) */
+#define NOISE_PCT    5.0  /* default minimum throughput noise, in percent (-n) */
+#define UTIL_SLACK   0.001 /* utilization is deterministic; allow rounding only */
 #define DEBUG
 #ifdef DEBUG
 # define dbg_printf(...) printf(__VA_ARGS__)
@@ -72,8 +82,13 @@ typedef struct {
     enum { ALLOC, FREE, REALLOC } type; /* type of request */
     int index;                        /* index for free() to use later */
     size_t size;                      /* byte size of alloc/realloc request */
+    int hint;                         /* MM_HINT_* flags of an alloc, or 0 */
 } traceop_t;
 
+/* Hinted allocations go through mm_malloc_hint */
+#define TRACE_MALLOC(op) ((op)->hint ? mm_malloc_hint((op)->size, (op)->hint) \
+                                     : mm_malloc((op)->size))
+
 /* Holds the information for one trace file*/
 typedef struct {
     char filename[MAXLINE];
@@ -95,8 +110,18 @@ typedef struct {
 typedef struct {
     trace_t *trace;
     range_t *ranges;
+    int *live;       /* ids of the live blocks, in no order (-L) */
+    int *slot;       /* position of each id in live, or -1 if not live */
+    int *recent;     /* ring of the most recently allocated ids */
+    double lines;    /* cache lines read or written by the last run */
 } speed_t;
 
+/* Per-op latency of a trace, in ns */
+typedef struct {
+    double p50, p99, p999, max; /* over every op of every replay */
+    double worst;               /* slowest op, taking each op's fastest replay */
+} latency_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -106,10 +131,23 @@ typedef struct {
 
     /* run-time stats defined for both libc and student */
     int valid;       /* was the trace processed correctly by the allocator? */
-    double secs;     /* number of secs needed to run the trace */
+    double secs;     /* number of secs needed to run the trace (median of runs) */
+    double secs_lo;  /* 95% confidence interval for secs */
+    double secs_hi;
+    int runs;        /* number of timed runs (-r) */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    perfctr_t perf;  /* hardware events over one run of the trace (-P) */
+    double acc_secs;     /* secs to run the trace touching payloads (-L) */
+    double acc_lines;    /* cache lines touched in one such run */
+    perfctr_t acc_perf;  /* hardware events over one such run (-L -P) */
+    double rss;      /* peak resident bytes of the heap, payloads written */
+    double rss_util; /* peak payload bytes / rss */
+    double minflt;   /* page faults during the utilization run */
+    double majflt;
+    struct mm_counters ctr; /* hot-path counters of the utilization run (-K) */
+    latency_t lat;   /* per-op latency (-T) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -149,6 +187,67 @@ int onetime_flag = 0;
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* Timed and warmup runs of each trace, and the CPU to pin to (-r, -w, -a) */
+static int num_runs = 11;
+static int num_warmup = 2;
+static int pin_cpu = -1;
+
+/* If set, count hardware events for each trace (-P) */
+static int use_perf = 0;
+
+/* If set, print resident memory and page faults for each trace (-R) */
+static int show_rss = 0;
+
+/* If set, print the allocator's hot-path counters for each trace (-K) */
+static int show_counters = 0;
+
+/* If set, time every op of each trace and print the tail latencies (-T) */
+static int show_latency = 0;
+
+/* If set, hint allocs that live longer than this many ops as long-lived (-H) */
+static int hint_lifetime = 0;
+
+/* Replays whose per-op times measure_latency combines */
+#define LAT_RUNS 3
+
+/* Ops between samples of the resident heap size in eval_mm_util */
+#define RSS_SAMPLE 256
+
+/*
+ * Comparison mode (-m): the allocators loaded as modules, run after the
+ * one linked into mdriver and before glibc malloc
+ */
+#define MAX_MODULES 16
+static const mm_module_t *modules[MAX_MODULES];
+static int num_modules = 0;
+
+/* Soak mode: replay the traces against one heap for this many secs (-S) */
+static double soak_secs = 0;
+#define SOAK_REPORT 1.0  /* secs between soak progress lines */
+
+/*
+ * Soak through handles (-C): allocate with mm_halloc, and every
+ * COMPACT_OPS ops run one mm_compact step of compact_budget ns and
+ * trim the heap end down to TRIM_PAD bytes
+ */
+static long compact_budget = -1;
+#define COMPACT_OPS 1000
+#define TRIM_PAD    (64*1024)
+
+/*
+ * Application access simulation (-L, -W, -I): after each alloc/realloc
+ * the payload is written, and every access_interval ops access_set live
+ * blocks are read. The blocks read are the most recently allocated
+ * (recent), drawn uniformly from all live blocks (random), or the next
+ * live blocks in allocation order, resuming where the last read stopped
+ * (sweep).
+ */
+#define LINE_SIZE 64
+static enum { ACC_NONE, ACC_RECENT, ACC_RANDOM, ACC_SWEEP } access_pattern = ACC_NONE;
+static const char *access_names[] = { "none", "recent", "random", "sweep" };
+static int access_set = 64;
+static int access_interval = 16;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -191,11 +290,33 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_access(void *ptr);
+static int run_soak(int num_tracefiles, const char *tracedir,
+                    char **tracefiles);
+
+/* Routines for comparing several allocators on the same traces */
+static void load_module(const char *path);
+static int run_compare(int num_tracefiles, const char *tracedir,
+                       char **tracefiles);
+static void measure_latency(const mm_module_t *m, trace_t *trace,
+                            latency_t *lat);
+static const mm_module_t linked_module;
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printperf(int n, stats_t *stats);
+static void printaccess(int n, stats_t *stats);
+static void printrss(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void sumresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static double measure_secs(fsecs_test_funct f, void *argp, stats_t *stats);
+static void write_results(const char *path, int n, stats_t *stats,
+                          sum_stats_t *sumstats);
+static int compare_baseline(const char *path, int n, stats_t *stats,
+                            double noise_pct);
 static void usage(void);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -250,12 +371,45 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i]);
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            mm_stats[i].secs = measure_secs(eval_mm_speed, speed_params,
+                                            &mm_stats[i]);
+            if (use_perf) {
+                /* one more, untimed, run with the counters on */
+                perfctr_start();
+                eval_mm_speed(speed_params);
+                perfctr_stop(&mm_stats[i].perf);
+            }
+            if (show_latency) {
+                if (verbose > 1)
+                    printf("Timing each op.\n");
+                measure_latency(&linked_module, trace, &mm_stats[i].lat);
+            }
+            if (access_pattern != ACC_NONE) {
+                if (verbose > 1)
+                    printf("Replaying with payload accesses (%s).\n",
+                           access_names[access_pattern]);
+                speed_params->live = malloc(trace->num_ids * sizeof(int));
+                speed_params->slot = malloc(trace->num_ids * sizeof(int));
+                speed_params->recent = malloc(access_set * sizeof(int));
+                if (!speed_params->live || !speed_params->slot
+                    || !speed_params->recent)
+                    unix_error("malloc failed in run_tests");
+                mm_stats[i].acc_secs = fsecs(eval_mm_access, speed_params);
+                mm_stats[i].acc_lines = speed_params->lines;
+                if (use_perf) {
+                    perfctr_start();
+                    eval_mm_access(speed_params);
+                    perfctr_stop(&mm_stats[i].acc_perf);
+                }
+                free(speed_params->live);
+                free(speed_params->slot);
+                free(speed_params->recent);
+            }
         }
 
         free_trace(trace);
@@ -283,6 +437,10 @@ int main(int argc, char **argv)
     int run_libc = 0;     /* If set, run libc malloc (set by -l) */
     int autograder = 0;   /* if set then called by autograder (-A) */
     int checkpoint = 0;
+    char *outfile = NULL;      /* write machine-readable results here (-o) */
+    char *basefile = NULL;     /* compare against these results (-b) */
+    double noise_pct = NOISE_PCT;
+    int regressions = 0;
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput = 0, p1, p2, perfindex;
@@ -296,7 +454,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpVAlD")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:o:b:n:r:w:a:L:W:I:S:C:m:X:H:hpPRKTVAlD")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -357,6 +515,103 @@ int main(int argc, char **argv)
             set_timeout = atoi(optarg);
             break;
 
+        case 'o': /* Write results as JSON (or CSV if the name ends in .csv) */
+            outfile = optarg;
+            break;
+
+        case 'b': /* Compare results against a baseline written with -o */
+            basefile = optarg;
+            break;
+
+        case 'n': /* Minimum throughput noise threshold, in percent */
+            noise_pct = atof(optarg);
+            break;
+
+        case 'P': /* Count hardware events */
+            use_perf = 1;
+            break;
+
+        case 'R': /* Show resident memory and page faults */
+            show_rss = 1;
+            break;
+
+        case 'K': /* Show the allocator's hot-path counters */
+            {
+                struct mm_counters ctr;
+                if (mm_counters(&ctr) < 0)
+                    app_error("-K needs mm.c built with -DMM_COUNTERS (make COUNTERS=1)\n");
+            }
+            show_counters = 1;
+            break;
+
+        case 'T': /* Show per-op latency percentiles and maximum */
+            show_latency = 1;
+            break;
+
+        case 'H': /* Mark lifetimes in traces that carry no hints */
+            hint_lifetime = atoi(optarg);
+            break;
+
+        case 'S': /* Soak: replay the traces against one heap */
+            soak_secs = atof(optarg);
+            break;
+
+        case 'C': /* Soak through handles, compacting for <us> at a time */
+            compact_budget = (long)(atof(optarg) * 1000);
+            break;
+
+        case 'm': /* Compare with the allocator in this module */
+            load_module(optarg);
+            break;
+
+        case 'X': /* Set an allocator parameter: name=value */
+            {
+                char *eq = strchr(optarg, '=');
+                if (eq == NULL)
+                    app_error("-X expects name=value, not %s\n", optarg);
+                *eq = '\0';
+                if (mm_setparam(optarg, strtol(eq + 1, NULL, 0)) < 0)
+                    app_error("Unknown parameter or bad value: %s=%s\n",
+                              optarg, eq + 1);
+            }
+            break;
+
+        case 'r': /* Number of timed runs per trace */
+            num_runs = atoi(optarg);
+            if (num_runs < 1)
+                num_runs = 1;
+            break;
+
+        case 'w': /* Number of untimed warmup runs per trace */
+            num_warmup = atoi(optarg);
+            break;
+
+        case 'a': /* Pin to a CPU while measuring */
+            pin_cpu = atoi(optarg);
+            break;
+
+        case 'L': /* Simulate application accesses to the payloads */
+            for (i = ACC_RECENT; i <= ACC_SWEEP; i++)
+                if (strcmp(optarg, access_names[i]) == 0)
+                    access_pattern = i;
+            if (access_pattern == ACC_NONE) {
+                usage();
+                exit(1);
+            }
+            break;
+
+        case 'W': /* Blocks read per access round */
+            access_set = atoi(optarg);
+            if (access_set < 1)
+                access_set = 1;
+            break;
+
+        case 'I': /* Ops between access rounds */
+            access_interval = atoi(optarg);
+            if (access_interval < 1)
+                access_interval = 1;
+            break;
+
         case 'h': /* Print this message */
             usage();
             exit(0);
@@ -378,14 +633,36 @@ int main(int argc, char **argv)
     }
 
     /* Initialize the timing package */
+    if (set_bench_cpu(pin_cpu) < 0)
+        unix_error("Could not pin to CPU %d", pin_cpu);
+    set_bench_reps(num_runs);
+    set_bench_warmup(num_warmup);
     init_fsecs();
 
+    /* Open the hardware counters; carry on without them if we can't */
+    if (use_perf) {
+        int nctr = perfctr_init();
+        if (nctr == 0) {
+            printf("Hardware counters unavailable: %s\n", perfctr_error());
+            use_perf = 0;
+        } else if (nctr < PERFCTR_NUM && verbose) {
+            printf("Only %d of %d hardware counters available: %s\n",
+                   nctr, PERFCTR_NUM, perfctr_error());
+        }
+    }
+
     /* Initialize the timeout */
     if (set_timeout > 0) {
         signal(SIGALRM, timeout_handler);
         alarm(set_timeout); 
     }
 
+    /* A soak run or a comparison replaces the normal evaluation */
+    if (soak_secs > 0)
+        exit(run_soak(num_tracefiles, tracedir, tracefiles));
+    if (num_modules > 0)
+        exit(run_compare(num_tracefiles, tracedir, tracefiles));
+
     /*
      * Optionally run and evaluate the libc malloc package
      */
@@ -409,7 +686,8 @@ int main(int argc, char **argv)
                 speed_params.trace = trace;
                 if (verbose > 1)
                     printf("and performance.\n");
-                libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+                libc_stats[i].secs = measure_secs(eval_libc_speed, &speed_params,
+                                                  &libc_stats[i]);
             }
             free_trace(trace);
         }
@@ -450,9 +728,46 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (use_perf) {
+                printf("Hardware events per op for mm malloc:\n");
+                printperf(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (show_rss) {
+                printf("Resident memory for mm malloc:\n");
+                printrss(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (show_counters) {
+                printf("Hot-path counters for mm malloc:\n");
+                printcounters(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (show_latency) {
+                printf("Per-op latency for mm malloc (ns, %d replays):\n",
+                       LAT_RUNS);
+                printlatency(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (access_pattern != ACC_NONE) {
+                printf("Locality for mm malloc (%s, %d blocks every %d ops):\n",
+                       access_names[access_pattern], access_set, access_interval);
+                printaccess(num_tracefiles, mm_stats);
+                printf("\n");
+            }
         }
     }
 
+    /* Optionally save the results and check them against a baseline */
+    if (!onetime_flag) {
+        sumresults(num_tracefiles, mm_stats, &global_mm_sum_stats);
+        if (outfile)
+            write_results(outfile, num_tracefiles, mm_stats, &global_mm_sum_stats);
+        if (basefile)
+            regressions = compare_baseline(basefile, num_tracefiles, mm_stats,
+                                           noise_pct);
+    }
+
     /* Optionally compare the performance of mm and libc */
     if (run_libc) {
         printf("Comparison with libc malloc: mm/libc = %.0f Kops / %.0f Kops = %.2f\n", 
@@ -580,7 +895,7 @@ int main(int argc, char **argv)
                 avg_mm_throughput/1000.0, avg_mm_util*100);
         printf("%s\n", autoresult);
     }
-    exit(0);
+    exit(regressions ? 2 : 0);
 }
 
 
@@ -750,6 +1065,55 @@ static void check_index(const trace_t *trace, int opnum, int index) {
  * The following routines manipulate tracefiles
  *********************************************/
 
+/*
+ * parse_hint - the MM_HINT_* flags of a "hint=" tag on a request line:
+ *     l long-lived, s short-lived, z zeroed
+ */
+static int parse_hint(const char *line)
+{
+    const char *p = strstr(line, "hint=");
+    int hint = 0;
+
+    if (p == NULL)
+        return 0;
+    for (p += 5; *p && *p != ' ' && *p != '\n'; p++) {
+        switch (*p) {
+        case 'l': hint |= MM_HINT_LONG; break;
+        case 's': hint |= MM_HINT_SHORT; break;
+        case 'z': hint |= MM_HINT_ZERO; break;
+        default: app_error("Bad hint %c in: %s", *p, line);
+        }
+    }
+    return hint;
+}
+
+/*
+ * mark_lifetimes - hint each alloc as long-lived if its block outlives
+ *     more than ops requests (or is never freed), short-lived otherwise;
+ *     the same rule mrecord applies with MRECORD_LIFETIME
+ */
+static void mark_lifetimes(trace_t *trace, int ops)
+{
+    int *born;  /* op that allocated each id, or -1 */
+    int i;
+
+    if ((born = malloc(trace->num_ids * sizeof(int))) == NULL)
+        unix_error("malloc failed in mark_lifetimes");
+    memset(born, -1, trace->num_ids * sizeof(int));
+    for (i = 0; i < trace->num_ops; i++) {
+        traceop_t *op = &trace->ops[i];
+        if (op->type == ALLOC) {
+            op->hint = MM_HINT_LONG;  /* until its free is seen */
+            born[op->index] = i;
+        } else if (op->type == FREE && op->index >= 0 && born[op->index] >= 0) {
+            if (i - born[op->index] <= ops)
+                trace->ops[born[op->index]].hint = MM_HINT_SHORT;
+            born[op->index] = -1;
+        }
+    }
+    free(born);
+}
+
 /*
  * read_trace - read a trace file and store it in memory
  */
@@ -759,9 +1123,11 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     FILE *tracefile;
     trace_t *trace;
     char type[MAXLINE];
+    char line[MAXLINE];
     int index, size;
     int max_index = 0;
     int op_index;
+    int hinted = 0;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -813,26 +1179,35 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
+    while (fgets(line, MAXLINE, tracefile) != NULL) {
+        /* Each request is one line; after its fields, a hint= tag is
+         * read and anything else (such as the tid= and ns= tags written
+         * by mrecord) is ignored */
+        if (sscanf(line, "%s", type) != 1)
+            continue;
         switch(type[0]) {
         case 'a':
-            r = fscanf(tracefile, "%u %u", &index, &size);
+            r = sscanf(line, "%*s %u %u", &index, &size);
             trace->ops[op_index].type = ALLOC;
             trace->ops[op_index].index = index;
             trace->ops[op_index].size = size;
+            trace->ops[op_index].hint = parse_hint(line);
+            hinted |= trace->ops[op_index].hint != 0;
             max_index = (index > max_index) ? index : max_index;
             break;
         case 'r':
-            r = fscanf(tracefile, "%u %u", &index, &size);
+            r = sscanf(line, "%*s %u %u", &index, &size);
             trace->ops[op_index].type = REALLOC;
             trace->ops[op_index].index = index;
             trace->ops[op_index].size = size;
+            trace->ops[op_index].hint = 0;
             max_index = (index > max_index) ? index : max_index;
             break;
         case 'f':
-            r = fscanf(tracefile, "%ud", &index);
+            r = sscanf(line, "%*s %u", &index);
             trace->ops[op_index].type = FREE;
             trace->ops[op_index].index = index;
+            trace->ops[op_index].hint = 0;
             break;
         default:
             app_error("Bogus type character (%c) in tracefile %s\n",
@@ -844,6 +1219,8 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+    if (hint_lifetime > 0 && !hinted)
+        mark_lifetimes(trace, hint_lifetime);
 
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
@@ -928,7 +1305,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         case ALLOC: /* mm_malloc */
             
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((p = TRACE_MALLOC(&trace->ops[i])) == NULL) {
                 malloc_error(trace, i, "mm_malloc failed.");
                 return 0;
             }
@@ -1023,14 +1400,24 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
  *   is always the high water mark of the heap.
  *
  *   A higher number is better: 1 is optimal.
+ *
+ *   With -R, the same run also measures what the heap costs in real
+ *   memory: the heap starts with no pages resident, every payload is
+ *   written as an application would, and the resident bytes of the heap
+ *   are sampled every RSS_SAMPLE ops and at the end. stats->rss_util is
+ *   hwm over the peak resident size; the page faults taken are recorded
+ *   too. Without -R these fields stay 0.
+ *   With -K, the allocator's hot-path counters for the run are saved.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
     int i;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
+    size_t resident, max_resident = 0;
+    struct rusage ru0, ru1;
     char *p;
     char *newp, *oldp;
 
@@ -1038,6 +1425,10 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
+    if (show_rss) {
+        mem_discard();
+        getrusage(RUSAGE_SELF, &ru0);
+    }
     if (mm_init() < 0)
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
@@ -1048,7 +1439,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((p = TRACE_MALLOC(&trace->ops[i])) == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1056,6 +1447,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             /* Remember region and size */
             trace->blocks[index] = p;
             trace->block_sizes[index] = size;
+            if (show_rss)
+                memset(p, 0xa5, size);
 
             total_size += size;
             break;
@@ -1074,6 +1467,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             /* Remember region and size */
             trace->blocks[index] = newp;
             trace->block_sizes[index] = newsize;
+            if (show_rss && newsize > oldsize)
+                memset(newp + oldsize, 0xa5, newsize - oldsize);
 
             total_size += (newsize - oldsize);
             break;
@@ -1101,7 +1496,23 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
+
+        if (show_rss && i % RSS_SAMPLE == RSS_SAMPLE - 1
+            && (resident = mem_resident()) > max_resident)
+            max_resident = resident;
+    }
+
+    if (show_rss) {
+        if ((resident = mem_resident()) > max_resident)
+            max_resident = resident;
+        getrusage(RUSAGE_SELF, &ru1);
+        stats->rss = max_resident;
+        stats->rss_util = max_resident ? (double)max_total_size / max_resident : 0;
+        stats->minflt = ru1.ru_minflt - ru0.ru_minflt;
+        stats->majflt = ru1.ru_majflt - ru0.ru_majflt;
     }
+    if (show_counters)
+        mm_counters(&stats->ctr);
 
     printf(".");
 
@@ -1132,7 +1543,7 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = TRACE_MALLOC(&trace->ops[i])) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -1161,6 +1572,632 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * touch_block - read every cache line of a payload; return the number
+ *     of lines read
+ */
+static volatile unsigned char access_sink;
+
+static double touch_block(const char *p, size_t size)
+{
+    unsigned char sum = 0;
+    size_t off;
+
+    for (off = 0; off < size; off += LINE_SIZE)
+        sum += p[off];
+    access_sink += sum;
+    return (double)((size + LINE_SIZE - 1) / LINE_SIZE);
+}
+
+/*
+ * eval_mm_access - Like eval_mm_speed, but behave like an application
+ *    that uses its memory: write each payload when it is allocated or
+ *    reallocated, and every access_interval ops read access_set live
+ *    blocks chosen by access_pattern. The count of cache lines touched
+ *    is left in speed_t.lines.
+ */
+static void eval_mm_access(void *ptr)
+{
+    speed_t *params = (speed_t *)ptr;
+    trace_t *trace = params->trace;
+    int *live = params->live, *slot = params->slot, *recent = params->recent;
+    int nlive = 0, nrecent = 0, sweep = 0;
+    unsigned rng = 1;
+    double lines = 0;
+    int i, j, index, size;
+    char *p;
+
+    reinit_trace(trace);
+    memset(slot, -1, trace->num_ids * sizeof(int));
+    memset(recent, -1, access_set * sizeof(int));
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_access");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC:
+        case REALLOC:
+            if (trace->ops[i].type == ALLOC)
+                p = TRACE_MALLOC(&trace->ops[i]);
+            else
+                p = mm_realloc(trace->blocks[index], size);
+            if (p == NULL && size != 0)
+                app_error("mm_malloc/mm_realloc error in eval_mm_access");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            if (p == NULL) /* realloc to 0 frees the block */
+                goto dead;
+            memset(p, index, size);
+            lines += (size + LINE_SIZE - 1) / LINE_SIZE;
+            if (slot[index] < 0) {
+                slot[index] = nlive;
+                live[nlive++] = index;
+            }
+            recent[nrecent++ % access_set] = index;
+            break;
+
+        case FREE:
+            if (index < 0)
+                break;
+            mm_free(trace->blocks[index]);
+            trace->blocks[index] = NULL;
+            trace->block_sizes[index] = 0;
+        dead:
+            if (slot[index] >= 0) {
+                live[slot[index]] = live[--nlive];
+                slot[live[slot[index]]] = slot[index];
+                slot[index] = -1;
+            }
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_access");
+        }
+
+        if ((i + 1) % access_interval != 0 || nlive == 0)
+            continue;
+        for (j = 0; j < access_set; j++) {
+            switch (access_pattern) {
+            case ACC_RECENT:
+                if (j >= nrecent)
+                    break;
+                index = recent[(nrecent - 1 - j) % access_set];
+                break;
+            case ACC_RANDOM:
+                rng = rng * 1103515245 + 12345;
+                index = live[(rng >> 8) % nlive];
+                break;
+            default:
+                /* next live id after the last one read, wrapping */
+                do
+                    sweep = (sweep + 1) % trace->num_ids;
+                while (slot[sweep] < 0);
+                index = sweep;
+                break;
+            }
+            if (trace->blocks[index] != NULL)
+                lines += touch_block(trace->blocks[index],
+                                     trace->block_sizes[index]);
+        }
+    }
+    params->lines = lines;
+}
+
+/*
+ * soak_hrealloc - the -C stand-in for mm_malloc and mm_realloc: a new
+ *    handle, with the contents of the old one (if any) copied over
+ */
+static char *soak_hrealloc(char *old, int oldsize, int size)
+{
+    mm_handle_t h = mm_halloc(size), oldh = (mm_handle_t)(uintptr_t)old;
+
+    if (h == 0)
+        return NULL;
+    if (oldh) {
+        memcpy(mm_hlock(h), mm_hlock(oldh), oldsize < size ? oldsize : size);
+        mm_hunlock(oldh);
+        mm_hunlock(h);
+        mm_hfree(oldh);
+    }
+    return (char *)(uintptr_t)h;
+}
+
+static void soak_free(char *p)
+{
+    if (compact_budget >= 0)
+        mm_hfree((mm_handle_t)(uintptr_t)p);
+    else
+        mm_free(p);
+}
+
+/*
+ * run_soak - Replay the traces back to back against one heap, without
+ *    mem_reset_brk or mm_init between them, for soak_secs seconds, and
+ *    report the shape of the heap every SOAK_REPORT seconds. The blocks
+ *    a trace leaves allocated survive through the next trace and are
+ *    freed after it, so long-lived blocks interleave with new ones as
+ *    they do in a real process. Returns 0, or 1 if the heap ran out.
+ *    With -C the blocks are handles (mm_halloc), kept in trace->blocks
+ *    cast to pointers, and the heap is compacted and trimmed as it goes.
+ */
+static int run_soak(int num_tracefiles, const char *tracedir,
+                    char **tracefiles)
+{
+    trace_t **traces;
+    stats_t dummy;
+    char **old = NULL;           /* survivors of the previous trace */
+    int nold = 0, maxold = 0;
+    double live = 0, old_live = 0, ops = 0, report_ops = 0;
+    double first_heap = 0, first_kops = 0, heap = 0, kops = 0;
+    uint64_t start, last, now;
+    long passes = 0;
+    int t, i, j, index, size, failed = 0;
+    struct mm_heapinfo info;
+    char *p;
+
+    if ((traces = malloc(num_tracefiles * sizeof(trace_t *))) == NULL)
+        unix_error("malloc failed in run_soak");
+    for (t = 0; t < num_tracefiles; t++)
+        traces[t] = read_trace(&dummy, tracedir, tracefiles[t]);
+
+    mem_init();
+    if (mm_init() < 0)
+        app_error("mm_init failed in run_soak");
+
+    printf("Soaking mm malloc for %.0f secs over %d traces\n",
+           soak_secs, num_tracefiles);
+    printf("%8s%8s%10s%10s%6s%8s%7s%11s%9s\n", "secs", "passes",
+           "heap(KB)", "live(KB)", "util", "free", "chain", "big(KB)", "Kops");
+
+    start = last = bench_ticks();
+    while (!failed && bench_ticks_to_secs(bench_ticks() - start) < soak_secs) {
+        for (t = 0; t < num_tracefiles && !failed; t++) {
+            trace_t *trace = traces[t];
+            reinit_trace(trace);
+
+            for (i = 0; i < trace->num_ops; i++) {
+                index = trace->ops[i].index;
+                size = trace->ops[i].size;
+                switch (trace->ops[i].type) {
+                case ALLOC:
+                case REALLOC:
+                    if (compact_budget >= 0)
+                        p = soak_hrealloc(trace->blocks[index],
+                                          trace->block_sizes[index], size);
+                    else if (trace->ops[i].type == ALLOC)
+                        p = TRACE_MALLOC(&trace->ops[i]);
+                    else
+                        p = mm_realloc(trace->blocks[index], size);
+                    if (p == NULL && size != 0) {
+                        failed = 1;
+                        break;
+                    }
+                    live += (double)size - trace->block_sizes[index];
+                    trace->blocks[index] = p;
+                    trace->block_sizes[index] = size;
+                    break;
+                case FREE:
+                    if (index < 0)
+                        break;
+                    soak_free(trace->blocks[index]);
+                    live -= trace->block_sizes[index];
+                    trace->blocks[index] = NULL;
+                    trace->block_sizes[index] = 0;
+                    break;
+                default:
+                    app_error("Nonexistent request type in run_soak");
+                }
+                if (failed)
+                    break;
+                if (compact_budget >= 0 && i % COMPACT_OPS == COMPACT_OPS - 1) {
+                    mm_compact(compact_budget);
+                    mm_trim(TRIM_PAD);
+                }
+            }
+            ops += i;
+
+            /* Free the previous trace's survivors and keep this one's */
+            for (j = 0; j < nold; j++)
+                soak_free(old[j]);
+            live -= old_live;
+            nold = 0;
+            old_live = 0;
+            for (j = 0; j < trace->num_ids; j++) {
+                if (trace->blocks[j] == NULL)
+                    continue;
+                if (nold == maxold) {
+                    maxold = maxold ? 2 * maxold : 1024;
+                    if ((old = realloc(old, maxold * sizeof(char *))) == NULL)
+                        unix_error("realloc failed in run_soak");
+                }
+                old[nold++] = trace->blocks[j];
+                old_live += trace->block_sizes[j];
+            }
+
+            now = bench_ticks();
+            if (bench_ticks_to_secs(now - last) < SOAK_REPORT && !failed)
+                continue;
+            mm_heapinfo(&info);
+            heap = info.heap_size;
+            kops = (ops - report_ops) / 1e3 / bench_ticks_to_secs(now - last);
+            if (first_heap == 0) {
+                first_heap = heap;
+                first_kops = kops;
+            }
+            printf("%8.0f%8ld%10.0f%10.0f%5.0f%%%8lu%7lu%11.0f%9.0f\n",
+                   bench_ticks_to_secs(now - start), passes, heap / 1024,
+                   live / 1024, heap > 0 ? 100.0 * live / heap : 0,
+                   (unsigned long)info.free_blocks,
+                   (unsigned long)info.longest_chain,
+                   info.largest_free / 1024.0, kops);
+            last = now;
+            report_ops = ops;
+        }
+        passes++;
+    }
+
+    if (failed)
+        printf("mm_malloc failed after %.0f ops: heap exhausted at %.0f KB\n",
+               ops, mem_heapsize() / 1024.0);
+    else if (first_heap > 0)
+        printf("Heap %+.1f%%, throughput %+.1f%% from the first report to the last\n",
+               100.0 * (heap - first_heap) / first_heap,
+               100.0 * (kops - first_kops) / first_kops);
+    if (compact_budget >= 0) {
+        struct mm_stats st;
+        mm_stats(&st);
+        printf("Compaction moved %lu blocks (%.1f MB); trimming gave back %.1f MB\n",
+               st.moves, st.moved_bytes / 1048576.0, st.trimmed_bytes / 1048576.0);
+    }
+
+    free(old);
+    for (t = 0; t < num_tracefiles; t++)
+        free_trace(traces[t]);
+    free(traces);
+    mem_deinit();
+    return failed;
+}
+
+/**********************************************************************
+ * The following routines compare several allocators on the same
+ * traces: the mm.c linked into mdriver, each module loaded with -m,
+ * and glibc malloc as a reference.
+ **********************************************************************/
+
+static int libc_init(void) { return 0; }
+
+static const mm_module_t linked_module = {
+    MM_MODULE_VERSION, "mdriver", mm_init, mm_malloc, mm_free,
+    mm_realloc, mm_calloc, mm_checkheap,
+};
+
+static const mm_module_t libc_module = {
+    MM_MODULE_VERSION, "glibc", libc_init, malloc, free,
+    realloc, calloc, NULL,
+};
+
+/*
+ * load_module - dlopen an allocator module and add its entry table to
+ *     the list to compare
+ */
+static void load_module(const char *path)
+{
+    void *handle;
+    const mm_module_t *m;
+
+    if (num_modules == MAX_MODULES)
+        app_error("At most %d modules can be compared\n", MAX_MODULES);
+    /* dlopen searches the library path for names without a slash */
+    if (strchr(path, '/') == NULL) {
+        char buf[MAXLINE];
+        snprintf(buf, sizeof(buf), "./%s", path);
+        handle = dlopen(buf, RTLD_NOW | RTLD_LOCAL);
+    } else {
+        handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    }
+    if (handle == NULL)
+        app_error("Could not load %s: %s\n", path, dlerror());
+    if ((m = dlsym(handle, MM_MODULE_SYMBOL)) == NULL)
+        app_error("%s does not export %s\n", path, MM_MODULE_SYMBOL);
+    if (m->version != MM_MODULE_VERSION)
+        app_error("%s was built for module version %d, not %d\n",
+                  path, m->version, MM_MODULE_VERSION);
+    modules[num_modules++] = m;
+}
+
+/* What one replay of a trace through a module measures */
+typedef enum { CMP_VALID, CMP_SPEED, CMP_LATENCY } cmp_mode_t;
+
+typedef struct {
+    const mm_module_t *m;
+    trace_t *trace;
+    cmp_mode_t mode;
+    range_t *ranges;     /* CMP_VALID: payload extents */
+    double *lat;         /* CMP_LATENCY: ticks of each op */
+    double util;         /* CMP_VALID: utilization, 0 for glibc */
+    int failed;          /* an op failed; the run was abandoned */
+} cmp_run_t;
+
+/* The results of one module on one trace */
+typedef struct {
+    int valid;
+    double ops;
+    double util;
+    double secs;
+    latency_t lat;
+} cmp_stats_t;
+
+/*
+ * cmp_replay - Run the trace once through run->m. CMP_VALID checks each
+ *    payload (alignment and, for the simulated heap, bounds and overlap)
+ *    and measures utilization; CMP_LATENCY times every op; CMP_SPEED only
+ *    runs the ops. Blocks still allocated at the end are freed, so that
+ *    glibc does not leak between runs.
+ */
+static void cmp_replay(void *ptr)
+{
+    cmp_run_t *run = (cmp_run_t *)ptr;
+    const mm_module_t *m = run->m;
+    trace_t *trace = run->trace;
+    int simulated = m != &libc_module;
+    int i, index, size, total = 0, max_total = 0;
+    uint64_t t0 = 0;
+    char *p;
+
+    reinit_trace(trace);
+    if (simulated)
+        mem_reset_brk();
+    if (m->init() < 0) {
+        run->failed = 1;
+        return;
+    }
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        if (run->mode == CMP_LATENCY)
+            t0 = bench_ticks();
+        switch (trace->ops[i].type) {
+        case ALLOC:
+        case REALLOC:
+            if (trace->ops[i].type == ALLOC)
+                p = m->malloc(size);
+            else
+                p = m->realloc(trace->blocks[index], size);
+            if (run->mode == CMP_LATENCY)
+                run->lat[i] = bench_ticks() - t0;
+            if (p == NULL && size != 0) {
+                run->failed = 1;
+                return;
+            }
+            if (run->mode == CMP_VALID) {
+                if (trace->blocks[index] != NULL)
+                    remove_range(&run->ranges, trace->blocks[index]);
+                if (p != NULL && !IS_ALIGNED(p)) {
+                    malloc_error(trace, i, "Payload address (%p) not aligned "
+                                 "to %d bytes", p, ALIGNMENT);
+                    run->failed = 1;
+                    return;
+                }
+                if (p != NULL && simulated
+                    && !add_range(&run->ranges, p, size, trace, i, index)) {
+                    run->failed = 1;
+                    return;
+                }
+                total += size - trace->block_sizes[index];
+                if (total > max_total)
+                    max_total = total;
+            }
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case FREE:
+            if (index < 0) {
+                m->free(NULL);
+                p = NULL;
+            } else {
+                p = trace->blocks[index];
+                m->free(p);
+            }
+            if (run->mode == CMP_LATENCY)
+                run->lat[i] = bench_ticks() - t0;
+            if (index < 0)
+                break;
+            if (run->mode == CMP_VALID) {
+                if (p != NULL && simulated)
+                    remove_range(&run->ranges, p);
+                total -= trace->block_sizes[index];
+            }
+            trace->blocks[index] = NULL;
+            trace->block_sizes[index] = 0;
+            break;
+
+        default:
+            app_error("Nonexistent request type in cmp_replay");
+        }
+    }
+
+    if (run->mode == CMP_VALID) {
+        /* Several checkheaps exit on failure, so only when asked (-D) */
+        if (m->checkheap && debug_mode == DBG_EXPENSIVE)
+            m->checkheap(__LINE__);
+        run->util = simulated && mem_heapsize() > 0 ?
+            (double)max_total / mem_heapsize() : 0;
+    }
+    for (i = 0; i < trace->num_ids; i++)
+        if (trace->blocks[i] != NULL)
+            m->free(trace->blocks[i]);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * measure_latency - Time every op of LAT_RUNS replays of the trace
+ *    through m. The percentiles and the maximum are over all the times
+ *    observed. worst first takes each op's fastest replay, which drops
+ *    interrupts and other one-off stalls that are not the allocator's
+ *    doing, and is then the slowest op.
+ */
+static void measure_latency(const mm_module_t *m, trace_t *trace,
+                            latency_t *lat)
+{
+    cmp_run_t run;
+    int n = trace->num_ops, total = LAT_RUNS * n;
+    double *all, *best;
+    int i, r;
+
+    memset(lat, 0, sizeof(*lat));
+    if (n == 0)
+        return;
+    memset(&run, 0, sizeof(run));
+    run.m = m;
+    run.trace = trace;
+    run.mode = CMP_LATENCY;
+    all = malloc(total * sizeof(double));
+    best = malloc(n * sizeof(double));
+    if (all == NULL || best == NULL)
+        unix_error("malloc failed in measure_latency");
+    for (r = 0; r < LAT_RUNS; r++) {
+        run.lat = all + r * n;
+        cmp_replay(&run);
+    }
+    for (i = 0; i < n; i++) {
+        best[i] = all[i];
+        for (r = 1; r < LAT_RUNS; r++)
+            if (all[r * n + i] < best[i])
+                best[i] = all[r * n + i];
+        if (best[i] > lat->worst)
+            lat->worst = best[i];
+    }
+    qsort(all, total, sizeof(double), cmp_double);
+    lat->p50 = bench_ticks_to_secs(all[total / 2]) * 1e9;
+    lat->p99 = bench_ticks_to_secs(all[(int)(total * 0.99)]) * 1e9;
+    lat->p999 = bench_ticks_to_secs(all[(int)(total * 0.999)]) * 1e9;
+    lat->max = bench_ticks_to_secs(all[total - 1]) * 1e9;
+    lat->worst = bench_ticks_to_secs(lat->worst) * 1e9;
+    free(all);
+    free(best);
+}
+
+/*
+ * cmp_trace - Check, time and measure the latency of one module on one
+ *    trace
+ */
+static void cmp_trace(const mm_module_t *m, trace_t *trace, cmp_stats_t *st)
+{
+    cmp_run_t run;
+    int n = trace->num_ops;
+
+    memset(st, 0, sizeof(*st));
+    memset(&run, 0, sizeof(run));
+    run.m = m;
+    run.trace = trace;
+
+    run.mode = CMP_VALID;
+    cmp_replay(&run);
+    clear_ranges(&run.ranges);
+    if (run.failed)
+        return;
+    st->valid = 1;
+    st->ops = n;
+    st->util = run.util;
+
+    run.mode = CMP_SPEED;
+    st->secs = fsecs(cmp_replay, &run);
+
+    measure_latency(m, trace, &st->lat);
+}
+
+/*
+ * run_compare - Run every trace against the linked allocator, each
+ *    module and glibc, and print a table per trace and a summary per
+ *    allocator. Returns 0, or 1 if some allocator failed a trace.
+ */
+static int run_compare(int num_tracefiles, const char *tracedir,
+                       char **tracefiles)
+{
+    const mm_module_t *all[MAX_MODULES + 2];
+    cmp_stats_t *st;
+    stats_t dummy;
+    int nall = 0, t, k, failed = 0;
+
+    all[nall++] = &linked_module;
+    for (k = 0; k < num_modules; k++)
+        all[nall++] = modules[k];
+    all[nall++] = &libc_module;
+
+    if ((st = calloc(num_tracefiles * nall, sizeof(cmp_stats_t))) == NULL)
+        unix_error("calloc failed in run_compare");
+
+    printf("%-10s%6s%6s%9s%8s%8s%8s%9s  %s\n", "allocator", "valid",
+           "util", "Kops", "p50", "p99", "p99.9", "max(ns)", "trace");
+    for (t = 0; t < num_tracefiles; t++) {
+        trace_t *trace = read_trace(&dummy, tracedir, tracefiles[t]);
+        mem_init();
+        for (k = 0; k < nall; k++) {
+            cmp_stats_t *s = &st[t * nall + k];
+            cmp_trace(all[k], trace, s);
+            printf("%-10s%6s", all[k]->name, s->valid ? "yes" : "no");
+            if (!s->valid) {
+                printf("%6s%9s%8s%8s%8s%9s", "-", "-", "-", "-", "-", "-");
+                failed = 1;
+            } else {
+                if (all[k] == &libc_module)
+                    printf("%6s", "-");
+                else
+                    printf("%5.0f%%", s->util * 100.0);
+                printf("%9.0f%8.0f%8.0f%8.0f%9.0f",
+                       s->secs > 0 ? trace->num_ops / 1e3 / s->secs : 0,
+                       s->lat.p50, s->lat.p99, s->lat.p999, s->lat.max);
+            }
+            printf("  %s\n", trace->filename);
+        }
+        mem_deinit();
+        free_trace(trace);
+    }
+
+    /* Average util and p50, total throughput and worst tail latencies */
+    printf("\n%-10s%6s%6s%9s%8s%8s%8s%9s\n", "allocator", "valid",
+           "util", "Kops", "avg p50", "p99", "p99.9", "max(ns)");
+    for (k = 0; k < nall; k++) {
+        double util = 0, ops = 0, secs = 0, p50 = 0, p99 = 0, p999 = 0, max = 0;
+        int valid = 0;
+        for (t = 0; t < num_tracefiles; t++) {
+            cmp_stats_t *s = &st[t * nall + k];
+            if (!s->valid)
+                continue;
+            valid++;
+            util += s->util;
+            ops += s->ops;
+            secs += s->secs;
+            p50 += s->lat.p50;
+            p99 = s->lat.p99 > p99 ? s->lat.p99 : p99;
+            p999 = s->lat.p999 > p999 ? s->lat.p999 : p999;
+            max = s->lat.max > max ? s->lat.max : max;
+        }
+        printf("%-10s%3d/%-2d", all[k]->name, valid, num_tracefiles);
+        if (all[k] == &libc_module || valid == 0)
+            printf("%6s", "-");
+        else
+            printf("%5.0f%%", util / valid * 100.0);
+        printf("%9.0f%8.0f%8.0f%8.0f%9.0f\n",
+               secs > 0 ? ops / 1e3 / secs : 0,
+               valid ? p50 / valid : 0, p99, p999, max);
+    }
+    free(st);
+    return failed;
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1263,6 +2300,16 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * kops_halfwidth - half the width of the throughput confidence interval
+ */
+static double kops_halfwidth(const stats_t *stats)
+{
+    if (stats->secs_lo <= 0 || stats->secs_hi <= 0)
+        return 0;
+    return (stats->ops/1e3/stats->secs_lo - stats->ops/1e3/stats->secs_hi) / 2;
+}
+
 /*
  * printresults - prints a performance summary for some malloc package and returns
  *                a summary of the stats to the caller. 
@@ -1271,18 +2318,15 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
 {
     int i;
 
-    /* weighted sums all */
-    double sumsecs = 0;
-    double sumops  = 0;
-    double sumutil = 0;
+    /* weights counted for the aggregate line */
     int sum_perf_weight = 0;
     int sum_util_weight = 0;
 
     char wstr;
 
     /* Print the individual results for each trace */
-    printf("  %2s%6s %5s%8s%9s  %s\n",
-           "valid", "util", "ops", "secs", "Kops", "trace");
+    printf("  %2s%6s %5s%8s%9s%6s  %s\n",
+           "valid", "util", "ops", "secs", "Kops", "+-", "trace");
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
             switch(stats[i].weight)
@@ -1319,74 +2363,519 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
             /* print '--' if perf isn't weighted */
             if(stats[i].weight == WNONE || stats[i].weight == WALL
                || stats[i].weight == WPERF)
-                printf("%8.0f%10.6f%6.0f", stats[i].ops, stats[i].secs,
-                       (stats[i].ops/1e3)/stats[i].secs);
+                printf("%8.0f%10.6f%6.0f%6.0f", stats[i].ops, stats[i].secs,
+                       (stats[i].ops/1e3)/stats[i].secs,
+                       kops_halfwidth(&stats[i]));
             else
-                printf("%8s%10s%6s", "--", "--", "--");
+                printf("%8s%10s%6s%6s", "--", "--", "--", "--");
 
             printf(" %s\n", stats[i].filename);
 
             if(stats[i].weight == WALL || stats[i].weight == WPERF)
-                {
-                    sum_perf_weight += 1;
-                    sumsecs += stats[i].secs;
-                    sumops += stats[i].ops;
-                }
+                sum_perf_weight += 1;
             if(stats[i].weight == WALL || stats[i].weight == WUTIL)
-                {
-                    sum_util_weight += 1;
-                    sumutil += stats[i].util;
-                }
+                sum_util_weight += 1;
         }
         else {
-            printf("%2s%4s %6s%8s%10s%6s %s\n",
+            printf("%2s%4s %6s%8s%10s%6s%6s %s\n",
                    stats[i].weight != 0 ? "*" : "",
                    "no",
                    "-",
                    "-",
                    "-",
                    "-",
+                   "-",
                    stats[i].filename);
         }
     }
 
     /* Print the aggregate results for the set of traces */
+    sumresults(n, stats, sumstats);
     if (errors == 0) {
         if(sum_perf_weight == 0) 
             sum_perf_weight = 1;
         if(sum_util_weight == 0) 
             sum_util_weight = 1;
-
-        double util = (sumutil/(double)sum_util_weight)*100.0;
-        double tput = (sumsecs==0.0) ? 0 : (sumops/1e3)/sumsecs;
         printf("%2d %2d  %5.0f%%%8.0f%10.6f%6.0f\n",
                sum_util_weight,
                sum_perf_weight,
-               util,
-               sumops,
-               sumsecs,
-               tput);
-
-        /* Record the summary statistics so we can compare libc and
-           mm.cc */
-        sumstats->util = util;
-        sumstats->ops = sumops;
-        sumstats->secs = sumsecs;
-        sumstats->tput = tput;
+               sumstats->util,
+               sumstats->ops,
+               sumstats->secs,
+               sumstats->tput);
     }
     else {
         printf("     %8s%10s%6s\n",
                "-",
                "-",
                "-");
+    }
+}
+
+/*
+ * printperf - print the hardware event counts of each trace, per op,
+ *     and the per-op averages over all valid traces
+ */
+static void printperf(int n, stats_t *stats)
+{
+    int i, j;
+    double total[PERFCTR_NUM] = { 0 };
+    int have[PERFCTR_NUM] = { 0 };
+    double ops = 0;
+
+    for (j = 0; j < PERFCTR_NUM; j++)
+        printf("%10s", perfctr_name(j));
+    printf("  %s\n", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        for (j = 0; j < PERFCTR_NUM; j++) {
+            if (stats[i].perf.valid[j]) {
+                printf("%10.2f", stats[i].perf.val[j] / stats[i].ops);
+                total[j] += stats[i].perf.val[j];
+                have[j] = 1;
+            } else {
+                printf("%10s", "-");
+            }
+        }
+        ops += stats[i].ops;
+        printf("  %s\n", stats[i].filename);
+    }
+    for (j = 0; j < PERFCTR_NUM; j++) {
+        if (have[j] && ops > 0)
+            printf("%10.2f", total[j] / ops);
+        else
+            printf("%10s", "-");
+    }
+    printf("  %s\n", "(all traces)");
+}
 
+/*
+ * printrss - print the utilization of each trace against virtual and
+ *     resident heap size, with the page faults taken
+ */
+static void printrss(int n, stats_t *stats)
+{
+    int i;
+    double util = 0, rss_util = 0;
+    int valid = 0;
+
+    printf("%6s%9s%10s%10s%8s  %s\n",
+           "util", "rss-util", "rss(KB)", "minflt", "majflt", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("%5.0f%%%8.0f%%%10.0f%10.0f%8.0f  %s\n",
+               stats[i].util*100.0, stats[i].rss_util*100.0,
+               stats[i].rss/1024, stats[i].minflt, stats[i].majflt,
+               stats[i].filename);
+        util += stats[i].util;
+        rss_util += stats[i].rss_util;
+        valid++;
+    }
+    if (valid)
+        printf("%5.0f%%%8.0f%%  %s\n", util/valid*100.0,
+               rss_util/valid*100.0, "(average)");
+}
+
+/*
+ * printcounters - print what the allocator's hot paths did on each
+ *     trace: list nodes visited and size classes probed per find_fit,
+ *     the share of searches that failed, the coalesce cases, how often
+ *     place() split its block, the number of heap extensions, the share
+ *     of mallocs served from a fast bin and how often those were coalesced,
+ *     and the share split from the designated victim
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    int i, j;
+
+    printf("%9s%8s%7s%7s%6s%7s%7s%7s%7s%7s%7s%8s%7s%8s%7s  %s\n",
+           "fits", "nodes", "bins", "max", "miss", "coal1", "coal2", "coal3",
+           "coal4", "split", "exact", "extend", "fast", "consol", "dv", "trace");
+    for (i = 0; i < n; i++) {
+        struct mm_counters *c = &stats[i].ctr;
+        double calls = c->fit_calls ? c->fit_calls : 1;
+        double mallocs = calls + c->fast_hits + c->dv_hits;
+        double places = c->splits + c->unsplit ? c->splits + c->unsplit : 1;
+        double coal = 0;
+        if (!stats[i].valid)
+            continue;
+        for (j = 0; j < 4; j++)
+            coal += c->coalesce[j];
+        if (coal == 0)
+            coal = 1;
+        printf("%9lu%8.2f%7.2f%7lu%5.0f%%", c->fit_calls,
+               c->fit_nodes / calls, c->fit_bins / calls, c->fit_max_nodes,
+               100.0 * c->fit_misses / calls);
+        for (j = 0; j < 4; j++)
+            printf("%6.0f%%", 100.0 * c->coalesce[j] / coal);
+        printf("%6.0f%%%6.0f%%%8lu%6.0f%%%8lu%6.0f%%  %s\n",
+               100.0 * c->splits / places, 100.0 * c->exact / places,
+               c->extends, 100.0 * c->fast_hits / mallocs, c->consolidates,
+               100.0 * c->dv_hits / mallocs, stats[i].filename);
+    }
+}
+
+/*
+ * printlatency - print the per-op latency percentiles of each trace, the
+ *     slowest time observed, and the slowest op once each op's fastest
+ *     replay is taken
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    int i, valid = 0;
+    double p50 = 0, p99 = 0, p999 = 0, max = 0, worst = 0;
+
+    printf("%8s%8s%8s%9s%9s  %s\n", "p50", "p99", "p99.9", "max", "worst",
+           "trace");
+    for (i = 0; i < n; i++) {
+        latency_t *l = &stats[i].lat;
+        if (!stats[i].valid)
+            continue;
+        printf("%8.0f%8.0f%8.0f%9.0f%9.0f  %s\n", l->p50, l->p99, l->p999,
+               l->max, l->worst, stats[i].filename);
+        p50 += l->p50;
+        p99 = l->p99 > p99 ? l->p99 : p99;
+        p999 = l->p999 > p999 ? l->p999 : p999;
+        max = l->max > max ? l->max : max;
+        worst = l->worst > worst ? l->worst : worst;
+        valid++;
+    }
+    if (valid)
+        printf("%8.0f%8.0f%8.0f%9.0f%9.0f  %s\n", p50 / valid, p99, p999,
+               max, worst, "(avg p50, max of the rest)");
+}
+
+/*
+ * printaccess - compare the time of each trace with and without payload
+ *     accesses and, with -P, print misses per thousand cache lines touched
+ */
+static void printaccess(int n, stats_t *stats)
+{
+    static const int ctr[] = { PERFCTR_L1D_MISSES, PERFCTR_LLC_MISSES,
+                               PERFCTR_DTLB_MISSES };
+    int i, j;
+
+    printf("%10s%10s%7s%10s", "secs", "w/access", "ratio", "lines/op");
+    for (j = 0; j < 3; j++)
+        printf("%10s", perfctr_name(ctr[j]));
+    printf("  %s\n", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("%10.6f%10.6f%7.2f%10.1f", stats[i].secs, stats[i].acc_secs,
+               stats[i].secs > 0 ? stats[i].acc_secs / stats[i].secs : 0,
+               stats[i].acc_lines / stats[i].ops);
+        for (j = 0; j < 3; j++) {
+            if (stats[i].acc_perf.valid[ctr[j]] && stats[i].acc_lines > 0)
+                printf("%10.2f", 1e3 * stats[i].acc_perf.val[ctr[j]]
+                       / stats[i].acc_lines);
+            else
+                printf("%10s", "-");
+        }
+        printf("  %s\n", stats[i].filename);
+    }
+    if (use_perf)
+        printf("(misses per 1000 cache lines touched, allocator included)\n");
+}
+
+/*
+ * sumresults - compute the weighted summary of a set of trace results
+ */
+static void sumresults(int n, stats_t *stats, sum_stats_t *sumstats)
+{
+    int i;
+    double sumsecs = 0;
+    double sumops  = 0;
+    double sumutil = 0;
+    int sum_perf_weight = 0;
+    int sum_util_weight = 0;
+
+    if (errors != 0) {
         /* Record the summary statistics so we can compare libc and
            mm.c */
         sumstats->util = 0;
         sumstats->ops = 0;
         sumstats->secs = 0;
         sumstats->tput = 0;
+        return;
+    }
+
+    for (i=0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        if(stats[i].weight == WALL || stats[i].weight == WPERF) {
+            sum_perf_weight += 1;
+            sumsecs += stats[i].secs;
+            sumops += stats[i].ops;
+        }
+        if(stats[i].weight == WALL || stats[i].weight == WUTIL) {
+            sum_util_weight += 1;
+            sumutil += stats[i].util;
+        }
+    }
+    if(sum_perf_weight == 0) 
+        sum_perf_weight = 1;
+    if(sum_util_weight == 0) 
+        sum_util_weight = 1;
+
+    /* Record the summary statistics so we can compare libc and
+       mm.c */
+    sumstats->util = (sumutil/(double)sum_util_weight)*100.0;
+    sumstats->ops = sumops;
+    sumstats->secs = sumsecs;
+    sumstats->tput = (sumsecs==0.0) ? 0 : (sumops/1e3)/sumsecs;
+}
+
+/*
+ * measure_secs - time f(argp); record the confidence interval in stats
+ *     and return the estimate
+ */
+static double measure_secs(fsecs_test_funct f, void *argp, stats_t *stats)
+{
+    stats->runs = num_runs;
+    return fsecs_ci(f, argp, &stats->secs_lo, &stats->secs_hi);
+}
+
+/**********************************************************************
+ * The following routines save results in machine-readable form and
+ * compare them against a saved baseline.
+ **********************************************************************/
+
+/*
+ * json_escape - copy s into buf as the body of a JSON string: quotes
+ *     and backslashes are escaped, control characters become \u00XX
+ */
+static char *json_escape(const char *s, char *buf, size_t len)
+{
+    size_t i = 0;
+
+    for (; *s != '\0' && i + 7 < len; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            buf[i++] = '\\';
+            buf[i++] = c;
+        } else if (c < 0x20) {
+            i += sprintf(buf + i, "\\u%04x", c);
+        } else {
+            buf[i++] = c;
+        }
+    }
+    buf[i] = '\0';
+    return buf;
+}
+
+/*
+ * csv_quote - copy s into buf as a quoted CSV field: the field is put
+ *     in double quotes and quotes inside it are doubled
+ */
+static char *csv_quote(const char *s, char *buf, size_t len)
+{
+    size_t i = 0;
+
+    buf[i++] = '"';
+    for (; *s != '\0' && i + 3 < len; s++) {
+        if (*s == '"')
+            buf[i++] = '"';
+        buf[i++] = *s;
+    }
+    buf[i++] = '"';
+    buf[i] = '\0';
+    return buf;
+}
+
+/*
+ * write_results - write every stats_t field of every trace, plus the
+ *     summary, as JSON (one trace object per line) or, if the file name
+ *     ends in ".csv", as CSV with a final "summary" row
+ */
+static void write_results(const char *path, int n, stats_t *stats,
+                          sum_stats_t *sumstats)
+{
+    FILE *fp;
+    int i, j;
+    char name[6*MAXLINE];
+    size_t len = strlen(path);
+    int csv = len >= 4 && strcmp(path + len - 4, ".csv") == 0;
+
+    if ((fp = fopen(path, "w")) == NULL)
+        unix_error("Could not open %s in write_results", path);
+
+    if (csv) {
+        fprintf(fp, "trace,weight,valid,ops,secs,secs_lo,secs_hi,runs,util,kops,"
+                "rss,rss_util,minflt,majflt,acc_secs,acc_lines");
+        for (j = 0; j < PERFCTR_NUM; j++)
+            fprintf(fp, ",%s", perfctr_name(j));
+        fprintf(fp, "\n");
+        for (i = 0; i < n; i++) {
+            fprintf(fp, "%s,%d,%d,%.0f,%.9f,%.9f,%.9f,%d,%.6f,%.3f",
+                    csv_quote(stats[i].filename, name, sizeof(name)),
+                    stats[i].weight, stats[i].valid,
+                    stats[i].ops, stats[i].secs, stats[i].secs_lo, stats[i].secs_hi,
+                    stats[i].runs, stats[i].util,
+                    stats[i].secs > 0 ? (stats[i].ops/1e3)/stats[i].secs : 0);
+            fprintf(fp, ",%.0f,%.6f,%.0f,%.0f", stats[i].rss, stats[i].rss_util,
+                    stats[i].minflt, stats[i].majflt);
+            if (access_pattern != ACC_NONE)
+                fprintf(fp, ",%.9f,%.0f", stats[i].acc_secs, stats[i].acc_lines);
+            else
+                fprintf(fp, ",,");
+            for (j = 0; j < PERFCTR_NUM; j++) {
+                if (stats[i].perf.valid[j])
+                    fprintf(fp, ",%.0f", stats[i].perf.val[j]);
+                else
+                    fprintf(fp, ",");
+            }
+            fprintf(fp, "\n");
+        }
+        fprintf(fp, "summary,,%d,%.0f,%.9f,,,,%.6f,%.3f,,,,,,", errors == 0,
+                sumstats->ops, sumstats->secs, sumstats->util/100.0,
+                sumstats->tput);
+        for (j = 0; j < PERFCTR_NUM; j++)
+            fprintf(fp, ",");
+        fprintf(fp, "\n");
+    } else {
+        fprintf(fp, "{\n  \"traces\": [\n");
+        for (i = 0; i < n; i++) {
+            fprintf(fp, "    {\"trace\": \"%s\", \"weight\": %d, \"valid\": %d, "
+                    "\"ops\": %.0f, \"secs\": %.9f, \"secs_lo\": %.9f, "
+                    "\"secs_hi\": %.9f, \"runs\": %d, \"util\": %.6f, "
+                    "\"kops\": %.3f, \"rss\": %.0f, \"rss_util\": %.6f, "
+                    "\"minflt\": %.0f, \"majflt\": %.0f, \"perf\": {",
+                    json_escape(stats[i].filename, name, sizeof(name)),
+                    stats[i].weight, stats[i].valid,
+                    stats[i].ops, stats[i].secs, stats[i].secs_lo, stats[i].secs_hi,
+                    stats[i].runs, stats[i].util,
+                    stats[i].secs > 0 ? (stats[i].ops/1e3)/stats[i].secs : 0,
+                    stats[i].rss, stats[i].rss_util, stats[i].minflt,
+                    stats[i].majflt);
+            for (j = 0; j < PERFCTR_NUM; j++) {
+                fprintf(fp, "%s\"%s\": ", j ? ", " : "", perfctr_name(j));
+                if (stats[i].perf.valid[j])
+                    fprintf(fp, "%.0f", stats[i].perf.val[j]);
+                else
+                    fprintf(fp, "null");
+            }
+            fprintf(fp, "}, \"access\": ");
+            if (access_pattern == ACC_NONE) {
+                fprintf(fp, "null");
+            } else {
+                fprintf(fp, "{\"pattern\": \"%s\", \"set\": %d, "
+                        "\"interval\": %d, \"secs\": %.9f, \"lines\": %.0f",
+                        access_names[access_pattern], access_set,
+                        access_interval, stats[i].acc_secs, stats[i].acc_lines);
+                for (j = 0; j < PERFCTR_NUM; j++) {
+                    if (stats[i].acc_perf.valid[j])
+                        fprintf(fp, ", \"%s\": %.0f", perfctr_name(j),
+                                stats[i].acc_perf.val[j]);
+                }
+                fprintf(fp, "}");
+            }
+            fprintf(fp, "}%s\n", i < n-1 ? "," : "");
+        }
+        fprintf(fp, "  ],\n  \"summary\": {\"valid\": %d, \"util\": %.6f, "
+                "\"ops\": %.0f, \"secs\": %.9f, \"tput\": %.3f}\n}\n",
+                errors == 0, sumstats->util, sumstats->ops, sumstats->secs,
+                sumstats->tput);
+    }
+    fclose(fp);
+}
+
+/*
+ * json_number - find "key": <number> in a line written by write_results
+ */
+static int json_number(const char *line, const char *key, double *val)
+{
+    char pat[MAXLINE];
+    const char *p;
+
+    snprintf(pat, sizeof(pat), "\"%s\": ", key);
+    if ((p = strstr(line, pat)) == NULL)
+        return 0;
+    return sscanf(p + strlen(pat), "%lf", val) == 1;
+}
+
+/*
+ * compare_baseline - compare the results against a JSON file written
+ *     earlier with -o and return the number of regressions. A trace
+ *     regresses if it became invalid, if its utilization dropped, or if
+ *     its throughput dropped by more than the noise threshold: the
+ *     larger of noise_pct and the combined relative half-widths of the
+ *     two confidence intervals.
+ */
+static int compare_baseline(const char *path, int n, stats_t *stats,
+                            double noise_pct)
+{
+    FILE *fp;
+    char line[8*MAXLINE];
+    int i, found, regressions = 0;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        unix_error("Could not open baseline %s", path);
+
+    printf("Comparison with baseline %s:\n", path);
+    printf("  %7s %7s %8s %8s %7s %6s  %s\n",
+           "util", "base", "Kops", "base", "delta", "noise", "trace");
+    for (i = 0; i < n; i++) {
+        double bvalid = 0, bops = 0, bsecs = 0, blo = 0, bhi = 0, butil = 0;
+        double now_kops, base_kops, delta, rel_now, rel_base, noise;
+        int check_util, check_perf, bad = 0;
+        char esc[6*MAXLINE], name[6*MAXLINE + 16];
+
+        /* find this trace's line in the baseline */
+        snprintf(name, sizeof(name), "\"trace\": \"%s\"",
+                 json_escape(stats[i].filename, esc, sizeof(esc)));
+        rewind(fp);
+        found = 0;
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (strstr(line, name) != NULL) {
+                found = json_number(line, "valid", &bvalid)
+                    && json_number(line, "ops", &bops)
+                    && json_number(line, "secs", &bsecs)
+                    && json_number(line, "secs_lo", &blo)
+                    && json_number(line, "secs_hi", &bhi)
+                    && json_number(line, "util", &butil);
+                break;
+            }
+        }
+        if (!found) {
+            printf("  %7s %7s %8s %8s %7s %6s  %s (not in baseline)\n",
+                   "-", "-", "-", "-", "-", "-", stats[i].filename);
+            continue;
+        }
+        if (!stats[i].valid) {
+            printf("  %7s %7s %8s %8s %7s %6s  %s%s\n",
+                   "-", "-", "-", "-", "-", "-", stats[i].filename,
+                   bvalid ? " REGRESSED (invalid)" : " (invalid)");
+            regressions += bvalid != 0;
+            continue;
+        }
+
+        check_util = stats[i].weight != WPERF;
+        check_perf = stats[i].weight != WUTIL;
+        now_kops = (stats[i].ops/1e3)/stats[i].secs;
+        base_kops = bsecs > 0 ? (bops/1e3)/bsecs : 0;
+        delta = base_kops > 0 ? (now_kops - base_kops)/base_kops * 100.0 : 0;
+        rel_now = (stats[i].secs_hi - stats[i].secs_lo) / 2 / stats[i].secs;
+        rel_base = bsecs > 0 ? (bhi - blo) / 2 / bsecs : 0;
+        noise = sqrt(rel_now*rel_now + rel_base*rel_base) * 100.0;
+        if (noise < noise_pct)
+            noise = noise_pct;
+
+        if (check_util && stats[i].util < butil - UTIL_SLACK)
+            bad = 1;
+        if (check_perf && bvalid && delta < -noise)
+            bad = 1;
+        regressions += bad;
+
+        printf("  %6.1f%% %6.1f%% %8.0f %8.0f %+6.1f%% %5.1f%%  %s%s\n",
+               stats[i].util*100.0, butil*100.0, now_kops, base_kops,
+               delta, noise, stats[i].filename, bad ? " REGRESSED" : "");
     }
+    fclose(fp);
+    printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+    return regressions;
 }
 
 /*
@@ -1447,4 +2936,22 @@ static void usage(void)
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-P         Count hardware events (cycles, misses) per trace.\n");
+    fprintf(stderr, "\t-R         Show resident heap size, RSS utilization and page faults.\n");
+    fprintf(stderr, "\t-T         Show per-op latency percentiles and maximum per trace.\n");
+    fprintf(stderr, "\t-K         Show find_fit, place and coalesce counters (make COUNTERS=1).\n");
+    fprintf(stderr, "\t-r <n>     Time each trace n times and report the median (default 11).\n");
+    fprintf(stderr, "\t-w <n>     Untimed warmup runs before timing (default 2).\n");
+    fprintf(stderr, "\t-a <cpu>   Pin the driver to CPU <cpu> while measuring.\n");
+    fprintf(stderr, "\t-L <pat>   Also replay touching payloads; pat = recent, random or sweep.\n");
+    fprintf(stderr, "\t-W <n>     Blocks read per access round for -L (default 64).\n");
+    fprintf(stderr, "\t-I <n>     Ops between access rounds for -L (default 16).\n");
+    fprintf(stderr, "\t-S <secs>  Soak: replay the traces against one heap, reporting its shape.\n");
+    fprintf(stderr, "\t-C <us>    With -S, allocate through handles and compact <us> at a time.\n");
+    fprintf(stderr, "\t-m <so>    Compare with the allocator module <so> (repeatable).\n");
+    fprintf(stderr, "\t-X <n>=<v> Set allocator parameter <n> to <v> (see mm.h).\n");
+    fprintf(stderr, "\t-H <ops>   Hint allocs living over <ops> ops as long-lived.\n");
+    fprintf(stderr, "\t-o <file>  Write results as JSON (CSV if <file> ends in .csv).\n");
+    fprintf(stderr, "\t-b <file>  Compare against a JSON baseline; exit 2 on regression.\n");
+    fprintf(stderr, "\t-n <pct>   Minimum throughput noise for -b (default %.0f%%).\n", NOISE_PCT);
 }
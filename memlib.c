@@ -3,6 +3,7 @@
  *						allows us to interleave calls from the student's malloc package 
  *						with the system's malloc package in libc.
  */
+#define _GNU_SOURCE /* memfd_create */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -12,14 +13,74 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/*
+ * Each heap lives in a region. The default region is the one set up by
+ * mem_init (or a file, mem_init_file); mem_region_create makes others,
+ * each in a mapping of its own that also holds the region itself. The
+ * functions below work on the calling thread's current region, which
+ * mem_region_select changes.
+ */
+struct mem_region {
+	char *heap;
+	char *mem_brk;
+	char *mem_max_addr;
+	int mem_fd;				/* file behind the heap (mem_init_file) */
+	size_t mem_filesize;	/* its size, kept at least brk */
+	char *mem_commit;		/* end of the read/write part of heap (!DRIVER) */
+	size_t mem_len;			/* length of the mapping (mem_region_create) */
+};
+
 /* private variables */
-static char *heap;
-static char *mem_brk;
-static char *mem_max_addr;
+static struct mem_region mem_default = { .mem_fd = -1 };
+static __thread struct mem_region *mem_cur
+	__attribute__((tls_model("initial-exec"))) = &mem_default;
+#define heap (mem_cur->heap)
+#define mem_brk (mem_cur->mem_brk)
+#define mem_max_addr (mem_cur->mem_max_addr)
+#define mem_fd (mem_cur->mem_fd)
+#define mem_filesize (mem_cur->mem_filesize)
+#define mem_commit (mem_cur->mem_commit)
+
+#ifdef DRIVER
+#define MEM_MAP_LEN MAX_HEAP
+#else
+#define MEM_MAP_LEN MEM_RESERVE
+#endif
+
+/*
+ * mem_grow_file - make the file behind the heap reach new_brk, growing
+ *		it a segment at a time. Returns 0 on success, -1 on failure.
+ */
+static int mem_grow_file(char *new_brk){
+	size_t need = new_brk - heap;
+	if (need <= mem_filesize)
+		return 0;
+	need = (need + MEM_SEGMENT - 1) & ~(size_t)(MEM_SEGMENT - 1);
+	if (need > MEM_MAP_LEN)
+		need = MEM_MAP_LEN;
+	if (ftruncate(mem_fd, need) < 0)
+		return -1;
+	mem_filesize = need;
+	return 0;
+}
+
+/*
+ * mem_drop - give back to the system the whole pages between lo (the
+ *		new brk) and hi (the old brk) after the heap has been shrunk
+ */
+static void mem_drop(char *lo, char *hi){
+	size_t page = (size_t)getpagesize();
+	char *start = (char *)(((size_t)lo + page - 1) & ~(page - 1));
+	if (start < hi)
+		madvise(start, hi - start, MADV_DONTNEED);
+}
+
+#ifdef DRIVER
 
 /* 
  * mem_init - initialize the memory system model
@@ -40,7 +101,13 @@ void mem_init(void){
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
-	munmap(heap, MAX_HEAP);
+	if (heap)
+		munmap(heap, MAX_HEAP);
+	if (mem_fd >= 0) {
+		close(mem_fd);
+		mem_fd = -1;
+	}
+	heap = mem_brk = mem_max_addr = NULL;
 }
 
 /*
@@ -52,24 +119,253 @@ void mem_reset_brk(){
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		by incr bytes and returns the start address of the new area.
+ *		A negative incr shrinks the heap (not below its start) and
+ *		returns the old brk.
  */
 void *mem_sbrk(int incr) {
-	char *old_brk = mem_brk;
+	char *old_brk;
 
+	if (heap == NULL)
+		mem_init();
+	old_brk = mem_brk;
     // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
-            sbrk(incr) == (void *) -1) {
+    // Only growth of the default, anonymous heap: a shrink would move the
+    // process break below memory that libc has taken since.
+	if ( (incr < 0 && -incr > mem_brk - heap) || ((mem_brk + incr) > mem_max_addr) ||
+            (mem_fd >= 0 && mem_grow_file(mem_brk + incr) < 0) ||
+            (incr > 0 && mem_cur == &mem_default && mem_fd < 0 &&
+             sbrk(incr) == (void *) -1)) {
 		errno = ENOMEM;
 		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
 	}
 
+	mem_brk += incr;
+	if (incr < 0)
+		mem_drop(mem_brk, old_brk);
+	return (void *)old_brk;
+}
+
+#else /* !DRIVER */
+
+/*
+ * Outside the driver (libmm.so) the heap is real memory: one large
+ * PROT_NONE reservation made on first use, committed in MEM_SEGMENT
+ * steps as the brk grows. The reservation only costs address space,
+ * and pages become resident when the allocator first touches them.
+ */
+/*
+ * mem_init - reserve the address range for the heap
+ */
+void mem_init(void){
+	heap = mmap(NULL, MEM_RESERVE, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (heap == MAP_FAILED) {
+		heap = NULL;
+		return;
+	}
+	mem_max_addr = heap + MEM_RESERVE;
+	mem_brk = heap;
+	mem_commit = heap;
+}
+
+/* 
+ * mem_deinit - release the heap reservation
+ */
+void mem_deinit(void){
+	if (heap)
+		munmap(heap, MEM_RESERVE);
+	if (mem_fd >= 0) {
+		close(mem_fd);
+		mem_fd = -1;
+	}
+	heap = mem_brk = mem_commit = mem_max_addr = NULL;
+}
+
+/*
+ * mem_reset_brk - make an empty heap; committed pages stay mapped
+ */
+void mem_reset_brk(){
+	mem_brk = heap;
+}
+
+/* 
+ * mem_sbrk - extend the heap by incr bytes, committing whole segments
+ *		as needed. A negative incr shrinks the heap; the pages above the
+ *		new brk stay committed but are given back to the system.
+ */
+void *mem_sbrk(int incr) {
+	char *old_brk;
+
+	if (heap == NULL)
+		mem_init();
+	old_brk = mem_brk;
+	if (heap == NULL || incr > mem_max_addr - mem_brk
+		|| (incr < 0 && -incr > mem_brk - heap)) {
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+	if (incr < 0) {
+		mem_brk += incr;
+		mem_drop(mem_brk, old_brk);
+		return (void *)old_brk;
+	}
+	if (mem_fd >= 0 && mem_grow_file(mem_brk + incr) < 0) {
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+	if (mem_brk + incr > mem_commit) {
+		size_t need = (mem_brk + incr) - mem_commit;
+		size_t len = (need + MEM_SEGMENT - 1) & ~(size_t)(MEM_SEGMENT - 1);
+		if (len > (size_t)(mem_max_addr - mem_commit))
+			len = mem_max_addr - mem_commit;
+		if (mprotect(mem_commit, len, PROT_READ | PROT_WRITE) < 0) {
+			errno = ENOMEM;
+			return (void *)-1;
+		}
+		mem_commit += len;
+	}
+
 	mem_brk += incr;
 	return (void *)old_brk;
 }
 
+#endif /* def DRIVER */
+
+/*
+ * mem_region_create - a new region of up to len bytes (0 for the size of
+ *		the default heap), in a read/write mapping that only takes memory
+ *		as it is touched. The region is not selected. Returns NULL on error.
+ */
+struct mem_region *mem_region_create(size_t len){
+	size_t page = mem_pagesize();
+	size_t hdr = (sizeof(struct mem_region) + 63) & ~(size_t)63;
+	struct mem_region *r, *old = mem_cur;
+
+	if (len == 0)
+		len = MEM_MAP_LEN;
+	len = (hdr + len + page - 1) & ~(page - 1);
+	r = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (r == MAP_FAILED)
+		return NULL;
+	mem_cur = r;
+	heap = (char *)r + hdr;
+	mem_brk = heap;
+	mem_max_addr = (char *)r + len;
+	mem_fd = -1;
+	mem_commit = mem_max_addr;
+	r->mem_len = len;
+	mem_cur = old;
+	return r;
+}
+
+/*
+ * mem_region_destroy - unmap a region made by mem_region_create, and
+ *		with it everything allocated in it. A thread that had it selected
+ *		goes back to the default region.
+ */
+void mem_region_destroy(struct mem_region *r){
+	if (r == NULL || r == &mem_default)
+		return;
+	if (mem_cur == r)
+		mem_cur = &mem_default;
+	munmap(r, r->mem_len);
+}
+
+/*
+ * mem_region_select - make r (NULL for the default region) the calling
+ *		thread's current region. Returns the previous one.
+ */
+struct mem_region *mem_region_select(struct mem_region *r){
+	struct mem_region *old = mem_cur;
+
+	mem_cur = r ? r : &mem_default;
+	return old;
+}
+
+/*
+ * mem_init_file - use the file at path, created if need be, as the heap:
+ *		it is mapped shared (at whatever address the system picks), so
+ *		the heap's contents are the file's and outlive the process. The
+ *		brk starts at the end of the file. Returns 1 if the file already
+ *		had contents, 0 if it was empty, -1 on error.
+ */
+int mem_init_file(const char *path){
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	int ret;
+
+	if (fd < 0)
+		return -1;
+	ret = mem_init_fd(fd);
+	close(fd);
+	return ret;
+}
+
+/*
+ * mem_init_fd - mem_init_file for a file that is already open; the
+ *		descriptor stays the caller's
+ */
+int mem_init_fd(int fd){
+	struct stat st;
+	char *p;
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size > MEM_MAP_LEN) {
+		errno = EFBIG;
+		return -1;
+	}
+	if ((fd = dup(fd)) < 0)
+		return -1;
+	p = mmap(NULL, MEM_MAP_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	if (heap)			/* the mapping mem_init made, or an earlier file */
+		munmap(heap, MEM_MAP_LEN);
+	if (mem_fd >= 0)
+		close(mem_fd);
+	heap = p;
+	mem_fd = fd;
+	mem_filesize = st.st_size;
+	mem_max_addr = heap + MEM_MAP_LEN;
+	mem_brk = heap + st.st_size;
+#ifndef DRIVER
+	mem_commit = mem_max_addr;	/* the whole mapping is read/write */
+#endif
+	return st.st_size > 0;
+}
+
+/*
+ * mem_init_shared - an empty heap in a new memfd, sized to the whole
+ *		mapping up front (its pages are only allocated when touched)
+ *		so that other processes mapping it never have to grow it.
+ *		Returns the memfd, or -1 on error.
+ */
+int mem_init_shared(void){
+	int fd = memfd_create("mm", 0);
+
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, MEM_MAP_LEN) < 0 || mem_init_fd(fd) < 0) {
+		close(fd);
+		return -1;
+	}
+	mem_brk = heap;
+	return fd;
+}
+
+/*
+ * mem_sync - write the heap (up to brk) back to its file; 0 if there
+ *		is no file. Returns 0 on success, -1 on failure.
+ */
+int mem_sync(void){
+	if (mem_fd < 0 || mem_brk == heap)
+		return 0;
+	return msync(heap, mem_brk - heap, MS_SYNC);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -91,6 +387,38 @@ size_t mem_heapsize() {
 	return (size_t)((void *)mem_brk - (void *)heap);
 }
 
+/*
+ * mem_discard - drop every page of the heap region from memory, so that
+ *		a following run starts with nothing resident. The contents are
+ *		lost: call only when the heap is empty (after mem_reset_brk).
+ */
+void mem_discard(void){
+	if (heap)
+		madvise(heap, mem_max_addr - heap, MADV_DONTNEED);
+}
+
+/*
+ * mem_resident - returns the bytes of the heap (up to brk) that are
+ *		resident in memory
+ */
+size_t mem_resident(void){
+	size_t page = mem_pagesize();
+	size_t npages = (mem_heapsize() + page - 1) / page;
+	size_t i, resident = 0;
+	unsigned char *vec;
+
+	if (heap == NULL || npages == 0)
+		return 0;
+	if ((vec = malloc(npages)) == NULL)
+		return 0;
+	if (mincore(heap, npages * page, vec) == 0) {
+		for (i = 0; i < npages; i++)
+			resident += vec[i] & 1;
+	}
+	free(vec);
+	return resident * page;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
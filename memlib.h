@@ -1,11 +1,22 @@
 #include <unistd.h>
 
+struct mem_region;
+
 void mem_init(void);               
 void mem_deinit(void);
+int mem_init_file(const char *path);
+int mem_init_fd(int fd);
+int mem_init_shared(void);
+int mem_sync(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+void mem_discard(void);
+size_t mem_resident(void);
+struct mem_region *mem_region_create(size_t len);
+void mem_region_destroy(struct mem_region *r);
+struct mem_region *mem_region_select(struct mem_region *r);
 
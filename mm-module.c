@@ -0,0 +1,35 @@
+/*
+ * mm-module.c - glue linked into each allocator module (mm*.so).
+ *
+ * The allocator is compiled with -DDRIVER, so its entry points are
+ * mm_malloc and friends, and with -fvisibility=hidden, so that several
+ * modules can be loaded into one mdriver without their symbols clashing.
+ * The only symbol a module exports is the mm_module entry table. The
+ * memlib functions are left undefined and bind to mdriver's copy (it is
+ * linked with -rdynamic), so every module allocates from the same
+ * simulated heap.
+ *
+ * MM_MODULE_NAME is set on the compiler command line.
+ */
+#include "mm.h"
+#include "mm-module.h"
+
+#ifndef MM_MODULE_NAME
+#define MM_MODULE_NAME "mm"
+#endif
+
+/* Not every implementation has these */
+extern void *mm_calloc(size_t nmemb, size_t size) __attribute__((weak));
+extern void mm_checkheap(int lineno) __attribute__((weak));
+
+__attribute__((visibility("default")))
+const mm_module_t mm_module = {
+    MM_MODULE_VERSION,
+    MM_MODULE_NAME,
+    mm_init,
+    mm_malloc,
+    mm_free,
+    mm_realloc,
+    mm_calloc,
+    mm_checkheap,
+};
@@ -0,0 +1,28 @@
+/*
+ * mm-module.h - the entry table exported by an allocator built as a
+ *     loadable module (mm*.so), so that mdriver can load several
+ *     implementations and run the same traces against each
+ */
+#ifndef __MM_MODULE_H_
+#define __MM_MODULE_H_
+
+#include <stddef.h>
+
+/* Bump when the layout of mm_module_t changes */
+#define MM_MODULE_VERSION 1
+
+typedef struct {
+    int version;                         /* MM_MODULE_VERSION */
+    const char *name;                    /* short name for tables */
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*calloc)(size_t nmemb, size_t size); /* NULL if not provided */
+    void (*checkheap)(int lineno);              /* NULL if not provided */
+} mm_module_t;
+
+/* Name of the table symbol each module exports */
+#define MM_MODULE_SYMBOL "mm_module"
+
+#endif /* __MM_MODULE_H_ */
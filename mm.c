@@ -1,14 +1,46 @@
 /*
  * mm.c
  * 使用了分离适配方法，1~(1<<STACK_MIN)单独分组，（1<<STACK_MIN)+1 ~ (1<<STACK_MAX)按2的幂分组，采用首次适配的策略
+ * 分组参数、扩展大小和分割阈值可以通过mm_setparam在运行时调整，于下一次mm_init生效
+ * tree_min以上的按幂分组用treap（按大小、地址排序）代替栈，在其中做best fit
+ * 其余各组的插入策略可选：LIFO（栈）、FIFO（队列）或按地址排序（按地址的treap，首次适配）
+ * 不超过fast_max的块释放时先放入按大小分的快速链表，不合并，同样大小的请求直接取走；
+ * 请求找不到适配块或快速链表中积累过多时再统一合并（consolidate）
+ * 分割剩下的块作为指定受害者（designated victim）保留在链表外，不超过dv_max的请求优先从中切分
+ * mm_malloc_hint标为长寿（MM_HINT_LONG）的块从空闲块的高地址一端切分，短命的块从低地址一端，
+ * 两者不交错，短命的块释放后仍能合并成大块
+ * mm_halloc分配的块通过句柄访问，未被mm_hlock钉住时mm_compact可以移动它们（限时、可分多次），
+ * 把空闲空间挪到堆尾，再由mm_trim把堆尾的空闲块还给系统
+ * 持久模式（mm_persist_open）下堆映射自文件，以超级块开头；堆内只存偏移，
+ * 堆外的状态在mm_persist_sync时存入超级块，文件下次映射到任何地址都能直接接着用
+ * 共享模式（mm_shared_create）下堆在memfd中，多个进程各自映射；超级块中有进程间的锁，
+ * 拿到锁时取回堆外的状态，放锁时存回，一个进程分配的块可以由另一个进程按偏移读取和释放
+ * 分配器的状态都在struct mm_heap中：malloc用默认的堆，mm_heap_create另建的堆各有自己的
+ * memlib区域和锁，mm_heap_destroy一次整个释放
+ * 实时模式（rt参数）下改为good fit：借助非空组的位图直接取一定满足请求的组的第一个块，malloc和free都是O(1)
  * 由于大小不超过2^32,故使用WSIZE存储地址偏移
  * 去掉了已分配块的尾部
  */
+#ifndef DRIVER
+#define _GNU_SOURCE /* PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP */
+#endif
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <execinfo.h>
+#include <time.h>
+#include <sys/mman.h>
+#ifdef MM_EVENTS
+#include <signal.h>
+#include <sys/syscall.h>
+#endif
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -33,6 +65,23 @@
 #define calloc mm_calloc
 #endif /* def DRIVER */
 
+/*
+ * 作为libmm.so被LD_PRELOAD时，所有入口用堆的递归锁串行化
+ * （递归是因为realloc等会调用内部的分配/释放）。
+ * 共享模式下还要加超级块中的进程间锁（同样是递归的）
+ */
+/// @brief 加进程间的锁，最外层时从超级块取回状态
+static void shared_lock(void);
+/// @brief 最外层时把状态存回超级块，放开进程间的锁
+static void shared_unlock(void);
+#ifdef DRIVER
+# define MM_LOCK() do { if (H(shared)) shared_lock(); } while (0)
+# define MM_UNLOCK() do { if (H(shared)) shared_unlock(); } while (0)
+#else
+# define MM_LOCK() do { pthread_mutex_lock(&H(lock)); if (H(shared)) shared_lock(); } while (0)
+# define MM_UNLOCK() do { if (H(shared)) shared_unlock(); pthread_mutex_unlock(&H(lock)); } while (0)
+#endif
+
 /* single word (4) or double word (8) alignment */
 #define ALIGNMENT 8 
 #define WSIZE 4 /*word size*/
@@ -41,6 +90,9 @@
 /* rounds up to the nearest multiple of ALIGNMENT */
 #define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
+#define MAX_REQUEST (1U<<30) /*块大小存放在WSIZE中，拒绝更大的请求*/
+/* 请求size字节所需的块大小：加上头部，按DSIZE对齐，至少能放下空闲块的前后继 */
+#define ADJUST_SIZE(size) ((size) <= DSIZE ? 2*DSIZE : DSIZE * (((size) + (WSIZE) + (DSIZE-1)) / DSIZE))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc)) 
@@ -55,6 +107,7 @@
 #define GET_PREV_FREE(p) (GET(((char*)(p)-WSIZE)) & 0x2) //去尾部专用
 #define SET_PREV_FREE(p) (GET(((char*)(p)-WSIZE)) |= 0x2) //去尾部专用
 #define RM_PREV_FREE(p) (GET(((char*)(p)-WSIZE)) &= ~0x2) //去尾部专用
+#define GET_MOVABLE(p) (GET(p) & 0x4) /*头部的第2位：句柄块，可以被mm_compact移动*/
 /* Given block ptr bp, compute address of its header and footer */
 #define HDRP(bp)       ((char *)(bp) - WSIZE)                      
 #define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE) 
@@ -63,14 +116,38 @@
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE))) 
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE))) 
 /*Given free block ptr bp,  relative address of next and previous blocks in stack*/
-#define GET_PREV(bp)  (*(int*)(bp) + stack_root) 
-#define GET_NEXT(bp)  (*(int*)((char*)(bp) + WSIZE) + stack_root)
+#define GET_PREV(bp)  (*(int*)(bp) + H(stack_root)) 
+#define GET_NEXT(bp)  (*(int*)((char*)(bp) + WSIZE) + H(stack_root))
 /*Given free block ptr bp,  set relative address of next and previous blocks in stack*/
-#define PUT_PREV(bp, pp)  (*(int*)(bp) = (char*)(pp) - stack_root) 
-#define PUT_NEXT(bp, np)  (*(int*)((char*)(bp) + WSIZE) = (char*)(np) - stack_root)
+#define PUT_PREV(bp, pp)  (*(int*)(bp) = (char*)(pp) - H(stack_root)) 
+#define PUT_NEXT(bp, np)  (*(int*)((char*)(bp) + WSIZE) = (char*)(np) - H(stack_root))
 /*get and set the top block in stack with index np*/
-#define GET_TOP(np) (*(int*)(stack_top + (unsigned int)(np)*WSIZE) + stack_root)
-#define SET_TOP(bp, np) (*(int*)(stack_top + (unsigned int)(np)*WSIZE) = (char*)(bp) - stack_root)
+#define GET_TOP(np) (*(int*)(H(stack_top) + (unsigned int)(np)*WSIZE) + H(stack_root))
+#define SET_TOP(bp, np) (*(int*)(H(stack_top) + (unsigned int)(np)*WSIZE) = (char*)(bp) - H(stack_root))
+/*树组的空闲块：前驱、后继两个字改作左右孩子，栈数组中存根；slot指向存放偏移的字*/
+#define TREE_LEFT(bp)  ((int*)(bp))
+#define TREE_RIGHT(bp) ((int*)((char*)(bp) + WSIZE))
+#define TREE_ROOT(np)  ((int*)(H(stack_top) + (unsigned int)(np)*WSIZE))
+#define TREE_NODE(slot) (*(slot) + H(stack_root))
+/*按(大小, 地址)排序，键唯一；优先级取偏移的散列，不占空间。
+ * 等间隔的地址经乘法散列后与键相关，按地址排序的树会退化，所以要充分混合*/
+static inline unsigned int tree_prio(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    return x ^ (x >> 16);
+}
+#define TREE_LESS(a, b) (GET_SIZE(HDRP(a)) < GET_SIZE(HDRP(b)) \
+    || (GET_SIZE(HDRP(a)) == GET_SIZE(HDRP(b)) && (char*)(a) < (char*)(b)))
+#define TREE_PRIO(bp) tree_prio((unsigned int)((char*)(bp) - H(stack_root)))
+/*
+ * 地址树的第三个字记录子树中最大的块，首次适配据此跳过放不下的子树。16字节的块没有这个字
+ * （那里是尾部），但它们只在自己的精准分组中，子树中都是16字节的块，最大值就是自身大小
+ */
+#define TREE_MAX(bp) (*(unsigned int*)((char*)(bp) + DSIZE))
+/*大小树（只在按幂分组中，块至少24字节）的第三个字存父结点的偏移，根为0*/
+#define TREE_UP(bp)  ((int*)((char*)(bp) + DSIZE))
 
 /* Function prototypes for internal helper routines */
 static void *extend_heap(size_t words);
@@ -82,6 +159,64 @@ static void place(void *bp, size_t asize);
 /// @param asize 给定查找大小
 /// @return 发现适合空闲块返回指针，否则返回空指针
 static void *find_fit(size_t asize);
+/// @brief 实时模式的查找：只看一定能满足asize的最小非空组的第一个块
+/// @param asize 给定查找大小
+/// @return 找到返回指针，否则返回空指针
+static void *find_fit_rt(size_t asize);
+/// @brief 在树组中做best fit：先在index组的树中找不小于asize的最小块，没有时取下一个非空树组的最小块
+/// @param asize 给定查找大小
+/// @param index 开始查找的树组
+/// @param first 查找开始的组，n 之前已检查过的块数（用于计数）
+/// @return 找到返回指针，否则返回空指针
+static void *find_fit_tree(size_t asize, unsigned int index, unsigned int first, unsigned int n);
+/// @brief 把空闲块插入slot为根的大小树（按(大小, 地址)排序）
+static void tree_insert(int *slot, char *bp);
+/// @brief 从slot为根的大小树中删除空闲块
+static void tree_delete(int *slot, char *bp);
+/// @brief 把空闲块插入slot为根的地址树（按地址排序，维护子树最大值）
+static void addr_insert(int *slot, char *bp);
+/// @brief 从slot为根的地址树中删除空闲块
+static void addr_delete(int *slot, char *bp);
+/// @brief 按地址顺序找t为根的树中第一个不小于asize的块，n累加检查过的块数
+static char *tree_first_fit(char *t, size_t asize, unsigned int *n);
+/// @brief t为根的子树中最大的块，空树为0
+static size_t tree_max(char *t);
+/// @brief 由孩子重算结点t的子树最大值
+static void tree_fix(char *t);
+/// @brief 为长寿的块分配：从空闲块的高地址一端切分
+/// @param size 请求的字节数
+static void *do_malloc_long(size_t size);
+/// @brief 在空闲块的高地址一端放置asize字节的块，低地址一端的剩余部分放回组中
+/// @param bp 空闲块
+/// @param asize 块大小
+/// @return 分配出的块
+static void *place_high(void *bp, size_t asize);
+/// @brief 把句柄块next移到它前面的空闲块bp处，空闲块随之移到它后面并与后面的空闲块合并
+/// @param bp 空闲块
+/// @param next bp后面未被钉住的句柄块
+/// @return 移动后的空闲块（已合并）
+static void *compact_move(void *bp, void *next);
+/// @brief 取一个空闲的句柄槽，必要时扩大句柄表
+/// @return 句柄（从1开始），失败返回0
+static mm_handle_t handle_new(void);
+/// @brief 把堆外的全局状态存入超级块
+static void super_save(void);
+/// @brief 从文件映射的堆开头的超级块恢复全局状态
+/// @return 成功返回0，不是有效的堆返回-1
+static int super_load(void);
+/// @brief 从超级块取回随分配变化的状态（组的位图、链表尾、快速链表、dv、统计和堆大小）
+static void super_state(void);
+/// @brief 把已分配块标为空闲并与相邻空闲块合并
+/// @param bp 块指针
+/// @return 合并后的块指针
+static void *release(void *bp);
+/// @brief 合并快速链表中的所有块
+/// @return 合并得到的最大空闲块的大小
+static size_t consolidate(void);
+/// @brief 第i组中最大的空闲块
+static size_t bin_largest(unsigned int i);
+/// @brief 解析policy参数名，返回组号（-1为所有组），-2不是policy参数，-3组号不合法
+static long policy_bin(const char *name);
 /// @brief 合并一个空闲块前后的空闲块
 /// @param bp 待合并空闲块
 /// @return 返回合并后的空闲块
@@ -98,133 +233,667 @@ static void print_heap();
 /// @param asize 
 /// @return 返回下标
 static unsigned int get_index(unsigned int asize);
+/// @brief 不加锁的malloc，供各入口共用
+static void *do_malloc(size_t size);
+/// @brief 不加锁的free，供各入口共用
+static void do_free(void *ptr);
+/// @brief 不加锁的realloc（oldptr非空、size非0时），供各入口共用
+static void *do_realloc(void *oldptr, size_t size);
+/// @brief 分配按alignment对齐的块，前部多余空间作为空闲块归还
+static void *do_memalign(size_t alignment, size_t size);
+/// @brief 清空堆采样记录，按新的采样间隔重新开始
+static void prof_reset(void);
+/// @brief 记录一个被采样的块及其调用栈
+/// @param bp 新分配的块
+/// @param size 请求的字节数
+static void prof_sample(void *bp, size_t size) __attribute__((noinline));
+/// @brief 块被释放时删除其采样记录（若有）
+static void prof_free(void *bp);
+/// @brief 被采样的块地址改变时（memalign）更新记录
+static void prof_move(void *from, void *to);
+static int in_heap(const void *p);
 /* Global variables */
+#define STACK_MIN (5) /*精准分配的位数（默认值）*/
+#define STACK_MAX (20) /*按幂分配的位数（默认值）*/
+#define TREE_MIN (1024) /*用树的最小块大小（默认值），0为不用树*/
+#define FAST_MAX (0) /*进快速链表的最大块大小（默认值），0为不用*/
+#define FAST_LIMIT (256) /*fast_max的上限*/
+#define FAST_BINS (FAST_LIMIT/DSIZE+1) /*按块大小/DSIZE编号*/
+#define FAST_CONSOLIDATE (1024) /*快速链表中的字节数超过它时合并*/
+#define DV_MAX (1024) /*从指定受害者中切分的最大请求（默认值），0为不用*/
+
+/*
+ * 分配器的全部状态，每个堆一份：malloc等入口用默认的堆mm_main，
+ * mm_heap_create建的堆各在自己的memlib区域中。mm_cur指向本线程正在操作的堆，
+ * 字段都经由它用下面的S()、H()访问，其余代码因此不必区分是哪个堆
+ */
+struct mm_state { /*持久、共享模式下整个存入超级块的部分*/
+    unsigned int stack_min;  /*精准分配的位数*/
+    unsigned int stack_max;  /*按幂分配的位数*/
+    unsigned int stack_base; /*第一个按幂分组的下标，即精准分组的个数*/
+    unsigned int stack_size; /*堆数组的长度*/
+    unsigned int chunksize;  /*每次扩展堆的最小字节数*/
+    unsigned int split_min;  /*分割后剩余部分的最小字节数*/
+    unsigned int rt_mode;    /*实时模式：good fit，不遍历链表*/
+    unsigned int bin_map;    /*第i位为1表示第i组非空（MM_MAX_BINS不超过32）*/
+    unsigned int tree_bin;   /*第一个树组的下标，不用树时为stack_size*/
+    unsigned int fast_max;   /*进快速链表的最大块大小，0为不用*/
+    unsigned int dv_max;     /*从dv切分的最大请求，0为不用*/
+    int fast_top[FAST_BINS]; /*各快速链表第一个块的偏移*/
+    unsigned char bin_policy[MM_MAX_BINS]; /*每组的插入策略*/
+    unsigned int policy_lifo; /*链表组都是LIFO（默认）：查找和增删不用逐组看bin_policy*/
+    int bin_tail[MM_MAX_BINS]; /*链表组最底下（最早加入）的块的偏移，FIFO从这里加入*/
+    struct mm_stats stats;   /*随堆的变化增量维护的统计信息，供mm_stats读取*/
+};
+struct mm_heap {
+    struct mm_state st;
+    char *heap_listp;        /* Pointer to first block*/
+    char *stack_top;         /* array of Pointer to first free block*/
+    char *stack_root;        /* 所有堆数组的首元素，作NULL使用*/
+    char *dv;                /*指定受害者，NULL为没有*/
+    struct mm_handle *handles;         /*句柄表*/
+    unsigned int nhandles, maxhandles; /*用过的项数，表的容量*/
+    mm_handle_t handle_free;  /*空闲槽链表的头，0为没有*/
+    mm_handle_t compact_from; /*mm_compact下次从这个句柄的块接着走，0为从头开始*/
+    struct mm_super *super;  /*持久模式下堆开头的超级块，否则为NULL*/
+    int persist;             /*堆映射自文件，mm_init要留出超级块*/
+    int shared;              /*堆由多个进程共享*/
+    int shared_depth;        /*进程间锁的嵌套层数，只有持锁者修改*/
+    uint64_t shared_gen;     /*本进程最后一次放锁时的gen，没变就不用取回状态*/
+    struct mem_region *mem;  /*堆所在的memlib区域，mm_main为NULL（默认区域）*/
+#ifndef DRIVER
+    pthread_mutex_t lock;
+#endif
+};
+#ifdef DRIVER
+static struct mm_heap mm_main;
+#else
+static struct mm_heap mm_main = { .lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP };
+#endif
+static __thread struct mm_heap *mm_cur __attribute__((tls_model("initial-exec"))) = &mm_main;
+#define S(x) (mm_cur->st.x) /*当前堆的mm_state字段*/
+#define H(x) (mm_cur->x)    /*当前堆的mm_heap字段*/
+
+/*
+ * 运行时参数：mm_setparam只修改value，mm_init时才复制到下面的变量中，
+ * 避免在堆中还有空闲块时改变分组方式
+ */
+static struct {
+    const char *name;
+    long value;
+    long lo, hi; /*合法范围*/
+    long align;  /*须为其倍数*/
+} params[] = {
+    { "stack_min", STACK_MIN, 4, 7, 1 },
+    { "stack_max", STACK_MAX, 1, 24, 1 },
+    { "chunksize", CHUNKSIZE, 2*DSIZE, 1<<24, DSIZE },
+    { "split_min", 2*DSIZE, 2*DSIZE, 1<<16, DSIZE },
+    { "sample_rate", 0, 0, 1L<<30, 1 },
+    { "rt", 0, 0, 1, 1 },
+    { "reserve", 0, 0, 1L<<30, DSIZE },
+    { "tree_min", TREE_MIN, 0, 1L<<30, DSIZE },
+    { "fast_max", FAST_MAX, 0, FAST_LIMIT, DSIZE },
+    { "dv_max", DV_MAX, 0, 1L<<30, DSIZE },
+};
+#define NPARAMS (sizeof(params)/sizeof(params[0]))
+enum { P_STACK_MIN, P_STACK_MAX, P_CHUNKSIZE, P_SPLIT_MIN, P_SAMPLE_RATE, P_RT, P_RESERVE, P_TREE_MIN, P_FAST_MAX, P_DV_MAX };
+
+/*
+ * 快速链表：释放的小块保持已分配的样子（头部和下一块的PREV_FREE位都不变），
+ * 因此不会被相邻块合并；用载荷的第一个字记录下一个块的偏移，0为空
+ */
+#define FAST_NEXT(bp) (*(int*)(bp))
+
+/*
+ * 指定受害者（dv）：最近一次为不超过dv_max的请求分割剩下的空闲块。它是普通的空闲块
+ * （有尾部，下一块的PREV_FREE位置位），只是不在任何组中；相邻块合并时由
+ * delete_stack认出并取下。之后的小请求先从它切分，依次得到相邻的地址
+ */
+
 /*
- * Initialize: return -1 on error, 0 on success.
+ * 句柄表：第h-1项记录句柄h的块相对stack_root的偏移和被钉住的次数。
+ * 句柄块的头部置MOVABLE位，载荷的第一个字存句柄，用户数据从bp+DSIZE开始，
+ * 因此mm_compact顺着堆走到句柄块时能找到并更新它的表项。
+ * 空闲的槽locks为HANDLE_FREE，off为下一个空闲槽的句柄。表在堆外单独mmap，
+ * 用满时换一个两倍大的
  */
-static char *heap_listp = NULL; /* Pointer to first block*/ 
-static char *stack_top = NULL; /* array of Pointer to first free block*/ 
-static char *stack_root = NULL;/* 所有堆数组的首元素，作NULL使用*/
-static unsigned int stack_size;/*堆数组的长度*/
-#define STACK_MIN (5) /*精准分配的位数*/
-#define STACK_MAX (20) /*按幂分配的位数*/
+struct mm_handle {
+    unsigned int off;
+    unsigned int locks;
+};
+#define HANDLE_FREE (~0U)
+#define HANDLE_MIN (1024)         /*句柄表的初始项数*/
+#define HANDLE_BLK(h) (H(handles)[(h)-1].off + H(stack_root))
+#define HANDLE_OF(bp) (*(mm_handle_t*)(bp))
+/*堆从文件打开时，上次运行留下的句柄块的句柄已经无效，不能移动*/
+#define IS_HANDLE_BLK(bp) (GET_MOVABLE(HDRP(bp)) && HANDLE_OF(bp) - 1U < H(nhandles) \
+    && H(handles)[HANDLE_OF(bp)-1].locks != HANDLE_FREE && HANDLE_BLK(HANDLE_OF(bp)) == (char*)(bp))
+#define COMPACT_CHECK (16)        /*mm_compact每走过这么多块（或移动一块后）看一次时间*/
+
+/*
+ * 持久模式的超级块，位于堆的开头（在栈数组之前）。空闲链表、树和快速链表都存为
+ * 相对stack_root的偏移，不用改；堆外的全局状态在mm_persist_sync时复制进来，
+ * 打开文件时复制回去，堆的其余部分（栈数组、序言块等）的位置由stack_size算出
+ */
+#define SUPER_MAGIC (0x6d6d6870U) /*"mmhp"*/
+struct mm_super {
+    pthread_mutex_t lock;   /*共享模式的进程间锁*/
+    uint64_t gen;           /*共享模式下每次放锁加1*/
+    uint32_t magic;
+    uint32_t size;          /*sizeof(struct mm_super)，布局变了就不认旧文件*/
+    uint64_t heap_size;     /*保存时的堆大小*/
+    uint64_t root;          /*根对象相对堆开头的偏移，0为没有*/
+    int64_t dv_off;         /*dv相对stack_root的偏移，0为没有*/
+    struct mm_state st;
+};
+#define SUPER_SIZE ALIGN(sizeof(struct mm_super))
+
+/*
+ * 每组的插入策略。POL_SIZE只用于tree_min以上的组；其余的组由policy参数选择，
+ * policy_param保存设置的值，mm_init时复制到bin_policy
+ */
+enum { POL_LIFO, POL_FIFO, POL_ADDR, POL_SIZE };
+static unsigned char policy_param[MM_MAX_BINS];
+
+/*
+ * 堆采样：平均每分配sample_rate字节采样一次（间隔服从指数分布，即泊松采样），
+ * 记录块地址与调用栈；释放时删除。记录存放在堆外单独mmap的区域中，
+ * 不占用块头的标志位。sample_rate为0时只多一次判断。
+ */
+#define PROF_DEPTH 32           /*调用栈最大深度*/
+#define PROF_SAMPLE_BUCKETS 4096
+#define PROF_STACK_BUCKETS 1024
+#define PROF_ARENA (32UL<<20)   /*记录区大小，用完后停止采样*/
+struct prof_stack {
+    uint64_t hash;
+    int depth;
+    void *pc[PROF_DEPTH];
+    long inuse_objs, inuse_bytes; /*仍存活的采样块*/
+    long alloc_objs, alloc_bytes; /*累计的采样块*/
+    struct prof_stack *next;
+};
+struct prof_sample {
+    const void *bp;
+    size_t size;
+    struct prof_stack *stack;
+    struct prof_sample *next;
+};
+static long prof_rate;          /*采样间隔（字节），0为关闭*/
+static long prof_left;          /*距下一次采样还剩的字节数*/
+static long prof_live;          /*存活的采样块数*/
+static int prof_busy;           /*采样或输出时置位，防止backtrace等重入*/
+static uint64_t prof_rand = 88172645463325252ULL;
+static char *prof_arena, *prof_brk;
+static struct prof_sample **prof_samples; /*按块地址散列*/
+static struct prof_stack **prof_stacks;   /*按调用栈散列*/
+static struct prof_sample *prof_free_list;
+/*
+ * 只采样默认的堆：mm_heap_destroy整个释放的堆中的块不会逐个经过free。
+ * 其他堆的入口只持有自己的锁，也不能碰采样的散列表
+ */
+#define PROF_MALLOC(bp, size) \
+    do { if (prof_rate && mm_cur == &mm_main && (prof_left -= (long)(size)) <= 0) prof_sample(bp, size); } while (0)
+#define PROF_LIVE (prof_live && mm_cur == &mm_main)
+
+/*
+ * 热路径计数（编译时定义MM_COUNTERS）：查找遍历的节点数与组数、合并的四种情况、
+ * 分割与否、扩展堆的次数，mm_init时清零。只计默认的堆。未定义时CTR为空宏
+ */
+#ifdef MM_COUNTERS
+static struct mm_counters ctrs;
+# define CTR(stmt) do { if (mm_cur == &mm_main) { stmt; } } while (0)
+# define CTR_FIT(nodes, bins, hit) do { \
+    unsigned long ctr_n = (nodes); \
+    if (mm_cur != &mm_main) break; \
+    ctrs.fit_calls++; ctrs.fit_nodes += ctr_n; ctrs.fit_bins += (bins); \
+    if (ctr_n > ctrs.fit_max_nodes) ctrs.fit_max_nodes = ctr_n; \
+    ctrs.fit_misses += !(hit); } while (0)
+#else
+# define CTR(stmt)
+# define CTR_FIT(nodes, bins, hit)
+#endif
+
+/*
+ * 事件记录（编译时定义MM_EVENTS）：每个线程一个单生产者单消费者的环形缓冲区，
+ * 各入口在返回前写入一条定长的二进制事件（struct mm_event），
+ * 由读者线程用mm_events_drain取走，或在信号处理函数中用mm_events_dump写入文件。
+ * 缓冲区满时丢弃新事件并计数，分配从不等待读者。
+ * 未定义MM_EVENTS时各钩子为空宏；定义了但未打开时每次操作只多一次判断。
+ */
+#ifdef MM_EVENTS
+#define EV_RING 65536           /*每个线程的事件数，须为2的幂（每线程2MB，用到才占物理页）*/
+#define EV_NOBIN 255            /*没有找到适配块*/
+struct ev_ring {
+    uint64_t head;              /*生产者（所属线程）写到的位置*/
+    uint64_t tail;              /*消费者读到的位置*/
+    uint64_t dropped;           /*缓冲区满而丢弃的事件数*/
+    uint32_t tid;
+    struct ev_ring *next;
+    struct mm_event ev[EV_RING];
+};
+static int ev_on;                         /*mm_events_enable设置*/
+static struct ev_ring *ev_rings;          /*所有线程的缓冲区，只增不减*/
+static __thread struct ev_ring *ev_mine;  /*本线程的缓冲区*/
+static __thread unsigned int ev_bin, ev_search, ev_freed; /*最近一次查找/释放的结果*/
+/// @brief 写入一条事件，op为MM_EV_*，t0为操作开始时的时间戳（0表示不计时）
+static void ev_record(int op, size_t size, const void *addr, uint64_t t0);
+static inline uint64_t ev_tsc(void) {
+#if defined(__i386__) || defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+# define EV_BEGIN() uint64_t ev_t0 = ev_on ? ev_tsc() : 0
+# define EV_END(op, size, addr) \
+    do { if (ev_on) ev_record(op, size, addr, ev_t0); } while (0)
+# define EV_FIT(bin, n) do { if (ev_on) { ev_bin = (bin); ev_search = (n); } } while (0)
+# define EV_FREED(size) do { if (ev_on) ev_freed = (size); } while (0)
+# define EV_EXTEND(bp, size) do { if (ev_on) ev_record(MM_EV_EXTEND, size, bp, 0); } while (0)
+#else
+# define EV_BEGIN()
+# define EV_END(op, size, addr)
+# define EV_FIT(bin, n)
+# define EV_FREED(size)
+# define EV_EXTEND(bp, size)
+#endif
+
 int mm_init(void) {
+    /* 应用运行时参数 */
+    S(stack_min) = params[P_STACK_MIN].value;
+    S(stack_max) = params[P_STACK_MAX].value;
+    S(chunksize) = params[P_CHUNKSIZE].value;
+    S(split_min) = params[P_SPLIT_MIN].value;
+    S(rt_mode) = params[P_RT].value;
+    S(fast_max) = S(rt_mode) ? 0 : params[P_FAST_MAX].value; /*合并要遍历快速链表，实时模式下不用*/
+    S(dv_max) = params[P_DV_MAX].value;
+    H(dv) = NULL;
+    H(nhandles) = 0;
+    H(handle_free) = 0;
+    H(compact_from) = 0;
+    if (mm_cur == &mm_main) { /*采样和计数只属于默认的堆*/
+        prof_rate = params[P_SAMPLE_RATE].value;
+        prof_reset();
+        CTR(memset(&ctrs, 0, sizeof(ctrs)));
+    }
+    S(stack_base) = (1<<S(stack_min))/DSIZE;
+    if (S(stack_base) + S(stack_max) > MM_MAX_BINS)
+        S(stack_max) = MM_MAX_BINS - S(stack_base);
     /* Create the initial empty heap */
-    stack_size = STACK_MAX + STACK_MIN-1;
-    stack_root = mem_sbrk(0);
-    if ((stack_top = mem_sbrk(stack_size*WSIZE)) == (void *)-1)
+    S(stack_size) = S(stack_base) + S(stack_max);
+    S(stack_size) += S(stack_size) % 2; /*保证之后的块按DSIZE对齐*/
+    S(tree_bin) = S(stack_size);
+    if (params[P_TREE_MIN].value && !S(rt_mode)) /*树的插入、删除不是O(1)，实时模式下不用*/
+        S(tree_bin) = MAX(get_index(params[P_TREE_MIN].value), S(stack_base));
+    S(policy_lifo) = 1;
+    for (unsigned int i = 0; i < MM_MAX_BINS; i++) {
+        S(bin_policy)[i] = i >= S(tree_bin) ? POL_SIZE : S(rt_mode) ? POL_LIFO : policy_param[i];
+        if (i < S(tree_bin) && S(bin_policy)[i] != POL_LIFO)
+            S(policy_lifo) = 0;
+    }
+    memset(S(bin_tail), 0, sizeof(S(bin_tail)));
+    memset(S(fast_top), 0, sizeof(S(fast_top)));
+    H(super) = NULL;
+    if (H(persist)) { /*堆映射自文件：从空堆开始，以超级块开头*/
+        if (mem_heapsize() > 0)
+            mem_sbrk(-(int)mem_heapsize());
+        if ((H(super) = mem_sbrk(SUPER_SIZE)) == (void *)-1)
+            return -1;
+        memset(H(super), 0, SUPER_SIZE);
+    }
+    H(stack_root) = mem_sbrk(0);
+    if ((H(stack_top) = mem_sbrk(S(stack_size)*WSIZE)) == (void *)-1)
         return -1;
-    memset(stack_top, 0, stack_size*WSIZE);//为栈数组分配空间，并全部初始化为stack_root
-    if ((heap_listp = mem_sbrk(6*WSIZE)) == (void *)-1) 
+    memset(H(stack_top), 0, S(stack_size)*WSIZE);//为栈数组分配空间，并全部初始化为stack_root
+    if ((H(heap_listp) = mem_sbrk(6*WSIZE)) == (void *)-1) 
         return -1;
-    PUT(heap_listp, PACK(0, 1));                          /* Alignment padding */
-    PUT(heap_listp + (1*WSIZE),0);
-    PUT(heap_listp + (2*WSIZE),0);
-    PUT(heap_listp + (3*WSIZE), PACK(DSIZE, 1)); /* Prologue header */ 
-    PUT(heap_listp + (4*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-    PUT(heap_listp + (5*WSIZE), PACK(0, 1));     /* Epilogue header */
-    stack_root = heap_listp + WSIZE;
-    heap_listp += (4*WSIZE);
-
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL) 
+    PUT(H(heap_listp), PACK(0, 1));                          /* Alignment padding */
+    PUT(H(heap_listp) + (1*WSIZE),0);
+    PUT(H(heap_listp) + (2*WSIZE),0);
+    PUT(H(heap_listp) + (3*WSIZE), PACK(DSIZE, 1)); /* Prologue header */ 
+    PUT(H(heap_listp) + (4*WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
+    PUT(H(heap_listp) + (5*WSIZE), PACK(0, 1));     /* Epilogue header */
+    H(stack_root) = H(heap_listp) + WSIZE;
+    H(heap_listp) += (4*WSIZE);
+    memset(&S(stats), 0, sizeof(S(stats)));
+    S(stats).nbins = S(stack_size);
+    S(bin_map) = 0;
+
+    /* 预留reserve字节，用完之前不再扩展堆（扩展是系统调用，实时线程应避免） */
+    if (extend_heap(MAX(S(chunksize), params[P_RESERVE].value)/WSIZE) == NULL) 
         return -1;
     return 0;
 }
 
+/*
+ * policy_bin - 参数名"policy"返回-1（所有组），"policy.<i>"返回i，
+ * 组号不合法返回-3，不是policy参数返回-2
+ */
+static long policy_bin(const char *name) {
+    char *end;
+    long bin;
+    if (strncmp(name, "policy", 6) != 0)
+        return -2;
+    if (name[6] == '\0')
+        return -1;
+    if (name[6] != '.')
+        return -2;
+    bin = strtol(name + 7, &end, 10);
+    if (end == name + 7 || *end != '\0' || bin < 0 || bin >= MM_MAX_BINS)
+        return -3;
+    return bin;
+}
+
+/*
+ * mm_setparam - 设置参数，下一次mm_init生效；名字未知或值不合法时返回-1
+ */
+int mm_setparam(const char *name, long value) {
+    long bin;
+    if ((bin = policy_bin(name)) != -2) {
+        if (bin == -3 || value < POL_LIFO || value > POL_ADDR) {
+            errno = EINVAL;
+            return -1;
+        }
+        MM_LOCK();
+        if (bin == -1)
+            memset(policy_param, value, sizeof(policy_param));
+        else
+            policy_param[bin] = value;
+        MM_UNLOCK();
+        return 0;
+    }
+    for (unsigned int i = 0; i < NPARAMS; i++) {
+        if (strcmp(name, params[i].name) != 0)
+            continue;
+        if (value < params[i].lo || value > params[i].hi
+            || value % params[i].align != 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        MM_LOCK();
+        params[i].value = value;
+        MM_UNLOCK();
+        return 0;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+/*
+ * mm_getparam - 读取参数已设置的值；名字未知时返回-1
+ */
+long mm_getparam(const char *name) {
+    long bin;
+    if ((bin = policy_bin(name)) != -2) {
+        if (bin == -3) {
+            errno = EINVAL;
+            return -1;
+        }
+        return policy_param[bin < 0 ? 0 : bin];
+    }
+    for (unsigned int i = 0; i < NPARAMS; i++)
+        if (strcmp(name, params[i].name) == 0)
+            return params[i].value;
+    errno = EINVAL;
+    return -1;
+}
+
 /*
  * malloc
  */
 void *malloc (size_t size) {
+    void *bp;
+    EV_BEGIN();
+    MM_LOCK();
+    bp = do_malloc(size);
+    MM_UNLOCK();
+    EV_END(MM_EV_MALLOC, size, bp);
+    return bp;
+}
+
+static void *do_malloc(size_t size) {
     dbg_printf("malloc %d\n",size);   
     size_t asize;      /* Adjusted block size */
     size_t extendsize; /* Amount to extend heap if no fit */
     char *bp;      
 
-    if (heap_listp == 0){
+    if (H(heap_listp) == 0){
         mm_init();
     }
+    EV_FIT(EV_NOBIN, 0);
+#ifndef DRIVER
+    /* libc的malloc(0)返回可释放的唯一指针 */
+    if (size == 0)
+        size = 1;
+#endif
     /* Ignore spurious requests */
     if (size == 0)
         return NULL;
+    if (size > MAX_REQUEST) {
+        errno = ENOMEM;
+        return NULL;
+    }
 
     /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DSIZE)                                          
-        asize = 2*DSIZE;                                        
-    else
-        asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE); 
+    asize = ADJUST_SIZE(size);
+
+    /* 快速链表中有同样大小的块，直接取走 */
+    if (asize <= S(fast_max) && S(fast_top)[asize/DSIZE]) {
+        bp = S(fast_top)[asize/DSIZE] + H(stack_root);
+        S(fast_top)[asize/DSIZE] = FAST_NEXT(bp);
+        S(stats).fast_bytes -= asize;
+        S(stats).fast_blocks--;
+        S(stats).alloc_bytes += asize;
+        S(stats).alloc_blocks++;
+        EV_FIT(get_index(asize), 1);
+        CTR(ctrs.fast_hits++);
+        PROF_MALLOC(bp, size);
+        return bp;
+    }
+
+    /* 小请求先从指定受害者切分，除非本组中有空闲块（否则组中的块会一直用不上） */
+    if (H(dv) && asize <= S(dv_max) && asize <= GET_SIZE(HDRP(H(dv)))
+        && !(S(bin_map) >> get_index(asize) & 1)) {
+        bp = H(dv);
+        EV_FIT(get_index(GET_SIZE(HDRP(bp))), 1);
+        CTR(ctrs.dv_hits++);
+        place(bp, asize);
+        PROF_MALLOC(bp, size);
+        return bp;
+    }
 
     /* Search the free list for a fit */
-    if ((bp = find_fit(asize)) != NULL) {  
+    bp = S(rt_mode) ? find_fit_rt(asize) : find_fit(asize);
+    if (bp == NULL && S(stats).fast_bytes >= asize && consolidate() >= asize)
+        bp = find_fit(asize); /*合并出了够大的块，再找一次*/
+    if (bp == NULL && H(dv) && asize <= GET_SIZE(HDRP(H(dv)))) /*组中没有，dv够大*/
+        bp = H(dv);
+    if (bp != NULL) {
         place(bp, asize);      
+        PROF_MALLOC(bp, size);
         dbg_print_heap();           
         return bp;
     }
 
     /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize,CHUNKSIZE);                 
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)  
+    extendsize = MAX(asize,S(chunksize));                 
+    if ((bp = extend_heap(extendsize/WSIZE)) == NULL) {
+        errno = ENOMEM;
         return NULL;                                  
+    }
     place(bp, asize);   
+    PROF_MALLOC(bp, size);
     dbg_print_heap();              
     return bp;
 }
 
+/*
+ * mm_malloc_hint - 按提示分配：长寿的块从空闲块的高地址一端切分，MM_HINT_ZERO时清零
+ */
+void *mm_malloc_hint(size_t size, int flags) {
+    void *bp;
+    EV_BEGIN();
+    MM_LOCK();
+    bp = (flags & MM_HINT_LONG) ? do_malloc_long(size) : do_malloc(size);
+    MM_UNLOCK();
+    if (bp && (flags & MM_HINT_ZERO))
+        memset(bp, 0, size);
+    EV_END(MM_EV_MALLOC, size, bp);
+    return bp;
+}
+
+static void *do_malloc_long(size_t size) {
+    size_t asize;
+    char *bp;
+
+    if (H(heap_listp) == 0){
+        mm_init();
+    }
+    if (size == 0 || size > MAX_REQUEST) /*交给do_malloc处理*/
+        return do_malloc(size);
+    asize = ADJUST_SIZE(size);
+    bp = S(rt_mode) ? find_fit_rt(asize) : find_fit(asize);
+    if (bp == NULL && H(dv) && asize <= GET_SIZE(HDRP(H(dv))))
+        bp = H(dv);
+    if (bp == NULL && (bp = extend_heap(MAX(asize,S(chunksize))/WSIZE)) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    bp = place_high(bp, asize);
+    PROF_MALLOC(bp, size);
+    dbg_print_heap();
+    return bp;
+}
+
 /*
  * free
  */
 void free (void *ptr) {
+    EV_BEGIN();
+    EV_FREED(0);
+    MM_LOCK();
+    do_free(ptr);
+    MM_UNLOCK();
+    EV_END(MM_EV_FREE, ev_freed, ptr);
+}
+
+static void do_free(void *ptr) {
     dbg_printf("free %p\n",ptr);
     if (ptr == 0) 
         return;
+#ifndef DRIVER
+    /* 不是本分配器给出的指针，忽略 */
+    if (H(heap_listp) == NULL || !in_heap(ptr))
+        return;
+#endif
     size_t size = GET_SIZE(HDRP(ptr));
-    unsigned int prev_free = GET_PREV_FREE(ptr);
-    if (heap_listp == NULL){
+    if (H(heap_listp) == NULL){
         mm_init();
     }
-    PUT(HDRP(ptr), PACK(size, 0));
-    PUT(FTRP(ptr), PACK(size, 0));
-    if(prev_free)
-        SET_PREV_FREE(ptr);
-    SET_PREV_FREE(NEXT_BLKP(ptr));
-    PUT_NEXT(ptr,NULL);
-    PUT_PREV(ptr,NULL);
-    coalesce(ptr);
+    S(stats).alloc_bytes -= size;
+    S(stats).alloc_blocks--;
+    EV_FREED(size);
+    if (PROF_LIVE)
+        prof_free(ptr);
+    if (size <= S(fast_max)) { /*放入快速链表，推迟合并*/
+        FAST_NEXT(ptr) = S(fast_top)[size/DSIZE];
+        S(fast_top)[size/DSIZE] = (char*)ptr - H(stack_root);
+        S(stats).fast_bytes += size;
+        S(stats).fast_blocks++;
+        CTR(ctrs.fast_frees++);
+        if (S(stats).fast_bytes > FAST_CONSOLIDATE)
+            consolidate();
+        return;
+    }
+    release(ptr);
     dbg_print_heap();
 }
 
+static void *release(void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    unsigned int prev_free = GET_PREV_FREE(bp);
+    PUT(HDRP(bp), PACK(size, 0));
+    PUT(FTRP(bp), PACK(size, 0));
+    if(prev_free)
+        SET_PREV_FREE(bp);
+    SET_PREV_FREE(NEXT_BLKP(bp));
+    PUT_NEXT(bp,NULL);
+    PUT_PREV(bp,NULL);
+    return coalesce(bp);
+}
+
+/*
+ * consolidate - 把快速链表中的块逐个释放并合并，返回合并出的最大块的大小。
+ * 链表中其余的块仍像已分配块，不会被提前合并，轮到它们时再与已经合并好的邻居合并
+ */
+static size_t consolidate(void) {
+    size_t largest = 0;
+    CTR(ctrs.consolidates++);
+    for (unsigned int i = 0; i < FAST_BINS; i++) {
+        while (S(fast_top)[i]) {
+            char *bp = S(fast_top)[i] + H(stack_root);
+            S(fast_top)[i] = FAST_NEXT(bp);
+            bp = release(bp);
+            largest = MAX(largest, GET_SIZE(HDRP(bp)));
+        }
+    }
+    S(stats).fast_bytes = 0;
+    S(stats).fast_blocks = 0;
+    return largest;
+}
+
 /*
  * realloc - you may want to look at mm-naive.c
  */
 void *realloc(void *oldptr, size_t size) {
     dbg_printf("realloc %d\n",size);
-    size_t oldsize;
     void *newptr;
 
     /* If size == 0 then this is just free, and we return NULL. */
     if(size == 0) {
-        mm_free(oldptr);
+        free(oldptr);
         return 0;
     }
 
     /* If oldptr is NULL, then this is just malloc. */
     if(oldptr == NULL) {
-        return mm_malloc(size);
+        return malloc(size);
     }
 
-    newptr = mm_malloc(size);
+    EV_BEGIN();
+    MM_LOCK();
+    newptr = do_realloc(oldptr, size);
+    MM_UNLOCK();
+    EV_END(MM_EV_REALLOC, size, newptr);
+    return newptr;
+}
+
+static void *do_realloc(void *oldptr, size_t size) {
+    size_t oldsize;
+    void *newptr;
 
-    /* If realloc() fails the original block is left untouched  */
-    if(!newptr) {
+#ifndef DRIVER
+    /* 不是本分配器给出的指针：读不到它的大小，不能复制，同do_free不去动它 */
+    if (H(heap_listp) == NULL || !in_heap(oldptr)) {
+        errno = ENOMEM;
         return 0;
     }
+#endif
+    newptr = do_malloc(size);
+
+    /* If realloc() fails the original block is left untouched  */
+    if(!newptr)
+        return 0;
 
     /* Copy the old data. */
-    oldsize = GET_SIZE(HDRP(oldptr));
+    oldsize = GET_SIZE(HDRP(oldptr)) - WSIZE;
     if(size < oldsize) oldsize = size;
     memcpy(newptr, oldptr, oldsize);
 
     /* Free the old block. */
-    mm_free(oldptr);
+    do_free(oldptr);
     dbg_print_heap();
     return newptr;
 }
@@ -239,92 +908,1488 @@ void *calloc (size_t nmemb, size_t size) {
     size_t bytes = nmemb * size;
     void *newptr;
 
-    newptr = malloc(bytes);
-    memset(newptr, 0, bytes);
+    if (size != 0 && bytes / size != nmemb) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* 直接调用do_malloc：gcc会把malloc+memset合并成对calloc的递归调用 */
+    EV_BEGIN();
+    MM_LOCK();
+    newptr = do_malloc(bytes);
+    MM_UNLOCK();
+    if (newptr)
+        memset(newptr, 0, bytes);
+    EV_END(MM_EV_CALLOC, bytes, newptr);
     dbg_print_heap();
     return newptr;
 }
 
+#ifndef DRIVER
+/*
+ * libc其余的分配接口，使libmm.so可以完整替换系统malloc
+ */
+void *memalign(size_t alignment, size_t size) {
+    void *bp;
+    EV_BEGIN();
+    MM_LOCK();
+    bp = do_memalign(alignment, size);
+    MM_UNLOCK();
+    EV_END(MM_EV_MEMALIGN, size, bp);
+    return bp;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    void *bp;
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment-1)) != 0)
+        return EINVAL;
+    if ((bp = memalign(alignment, size)) == NULL)
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size) {
+    return memalign(mem_pagesize(), size);
+}
+
+void *pvalloc(size_t size) {
+    size_t page = mem_pagesize();
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr) {
+    size_t size;
+    if (ptr == NULL)
+        return 0;
+    MM_LOCK();
+    /* 不是本分配器给出的指针（如动态链接器分配的）：没有我们的头部，同do_realloc返回0 */
+    if (H(heap_listp) == NULL || !in_heap(ptr)) {
+        MM_UNLOCK();
+        return 0;
+    }
+    size = GET_SIZE(HDRP(ptr)) - WSIZE;
+    MM_UNLOCK();
+    return size;
+}
 
 /*
- * Return whether the pointer is in the heap.
- * May be useful for debugging.
+ * fork时子进程只剩调用fork的线程，锁须处于可用状态
  */
-static int in_heap(const void *p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
+static void atfork_prepare(void) { MM_LOCK(); }
+static void atfork_parent(void) { MM_UNLOCK(); }
+static void atfork_child(void) {
+    pthread_mutexattr_t attr;
+    H(shared_depth) = 0; /*进程间的锁由父进程放开*/
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&H(lock), &attr);
+    pthread_mutexattr_destroy(&attr);
 }
 
+#ifdef MM_EVENTS
 /*
- * Return whether the pointer is aligned.
- * May be useful for debugging.
+ * MM_EVENTS_FILE=<文件> 打开事件记录，收到SIGUSR2时和退出时把缓冲区中的事件追加到文件
  */
-static int aligned(const void *p) {
-    return (size_t)ALIGN(p) == (size_t)p;
+static int ev_fd = -1;
+static void ev_signal(int sig) {
+    int saved = errno;
+    mm_events_dump(ev_fd);
+    errno = saved;
 }
+static void ev_lib_init(void) {
+    const char *path = getenv("MM_EVENTS_FILE");
+    struct sigaction sa;
+    if (path == NULL)
+        return;
+    if ((ev_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644)) < 0)
+        return;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ev_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+    mm_events_enable(1);
+}
+static void ev_lib_fini(void) {
+    unsigned long dropped;
+    if (ev_fd < 0)
+        return;
+    mm_events_enable(0);
+    mm_events_dump(ev_fd);
+    close(ev_fd);
+    if ((dropped = mm_events_dropped()) > 0)
+        fprintf(stderr, "libmm: %lu events dropped (rings full)\n", dropped);
+}
+#else
+# define ev_lib_init()
+# define ev_lib_fini()
+#endif
 
 /*
- * mm_checkheap
+ * MM_PROF_RATE=<字节> 打开堆采样，MM_PROF_FILE=<文件> 在退出时输出采样结果
  */
-void mm_checkheap(int lineno) {
-    unsigned int prev_alloc=1;
-    for(char* i=heap_listp;GET_SIZE(HDRP(i))>0;i=NEXT_BLKP(i)){
-        unsigned int alloc = GET_ALLOC(HDRP(i));
-        if(prev_alloc==0 && alloc==0)
-        {
-            printf("fail coaleacing\n");
-            exit(-1);
+__attribute__((constructor))
+static void mm_lib_init(void) {
+    const char *rate = getenv("MM_PROF_RATE");
+    pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+    ev_lib_init();
+    if (rate && mm_setparam("sample_rate", atol(rate)) == 0) {
+        /* 加载器可能已经调用过malloc，堆已初始化，直接生效 */
+        MM_LOCK();
+        prof_rate = params[P_SAMPLE_RATE].value;
+        prof_reset();
+        MM_UNLOCK();
+    }
+}
+
+__attribute__((destructor))
+static void mm_lib_fini(void) {
+    const char *path = getenv("MM_PROF_FILE");
+    int fd;
+    ev_lib_fini();
+    if (path == NULL || prof_rate == 0)
+        return;
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+        mm_heapprof_dump(fd);
+        close(fd);
+    }
+}
+#endif /* ndef DRIVER */
+
+static void *do_memalign(size_t alignment, size_t size) {
+    char *bp, *ap;
+    if ((alignment & (alignment-1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT)
+        return do_malloc(size);
+    if (size > MAX_REQUEST) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* 多申请alignment+2*DSIZE，保证前部余下的空间至少是最小块 */
+    if ((bp = do_malloc(size + alignment + 2*DSIZE)) == NULL)
+        return NULL;
+    if ((size_t)bp % alignment == 0)
+        return bp;
+    ap = (char *)(((size_t)bp + 2*DSIZE + alignment - 1) & ~(alignment - 1));
+    size_t lead = ap - bp;
+    size_t total = GET_SIZE(HDRP(bp));
+    if (PROF_LIVE)
+        prof_move(bp, ap);
+    /* bp由place分配，其前一块必为已分配块 */
+    PUT(HDRP(ap), PACK(total - lead, 1));
+    SET_PREV_FREE(ap);
+    PUT(HDRP(bp), PACK(lead, 0));
+    PUT(FTRP(bp), PACK(lead, 0));
+    S(stats).alloc_bytes -= lead;
+    PUT_NEXT(bp,NULL);
+    PUT_PREV(bp,NULL);
+    coalesce(bp);
+    return ap;
+}
+
+/*
+ * mm_halloc - 多分配DSIZE字节存句柄，块头置MOVABLE位
+ */
+mm_handle_t mm_halloc(size_t size) {
+    char *bp;
+    mm_handle_t h;
+    if (size > MAX_REQUEST) {
+        errno = ENOMEM;
+        return 0;
+    }
+    MM_LOCK();
+    if ((bp = do_malloc(size + DSIZE)) == NULL) {
+        MM_UNLOCK();
+        return 0;
+    }
+    if ((h = handle_new()) == 0) {
+        do_free(bp);
+        MM_UNLOCK();
+        return 0;
+    }
+    PUT(HDRP(bp), GET(HDRP(bp)) | 0x4);
+    HANDLE_OF(bp) = h;
+    H(handles)[h-1].off = bp - H(stack_root);
+    H(handles)[h-1].locks = 0;
+    MM_UNLOCK();
+    return h;
+}
+
+static mm_handle_t handle_new(void) {
+    mm_handle_t h;
+    if ((h = H(handle_free)) != 0) {
+        H(handle_free) = H(handles)[h-1].off;
+        return h;
+    }
+    if (H(nhandles) == H(maxhandles)) {
+        unsigned int max = H(maxhandles) ? 2*H(maxhandles) : HANDLE_MIN;
+        struct mm_handle *t = mmap(NULL, max * sizeof(*t), PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (t == MAP_FAILED)
+            return 0;
+        if (H(handles)) {
+            memcpy(t, H(handles), H(nhandles) * sizeof(*t));
+            munmap(H(handles), H(maxhandles) * sizeof(*t));
         }
-        prev_alloc = alloc;
+        H(handles) = t;
+        H(maxhandles) = max;
     }
+    return ++H(nhandles);
 }
-/* 
- * extend_heap - Extend heap with free block and return its block pointer
+
+/*
+ * mm_hfree - 释放句柄块，句柄放回空闲槽链表；无效的句柄忽略
  */
-static void *extend_heap(size_t words) 
-{
+void mm_hfree(mm_handle_t h) {
     char *bp;
-    size_t size;
+    MM_LOCK();
+    if (h == 0 || h > H(nhandles) || H(handles)[h-1].locks == HANDLE_FREE) {
+        MM_UNLOCK();
+        return;
+    }
+    bp = HANDLE_BLK(h);
+    PUT(HDRP(bp), GET(HDRP(bp)) & ~0x4); /*快速链表中的块不能被移动*/
+    do_free(bp);
+    H(handles)[h-1].locks = HANDLE_FREE;
+    H(handles)[h-1].off = H(handle_free);
+    H(handle_free) = h;
+    if (H(compact_from) == h)
+        H(compact_from) = 0;
+    MM_UNLOCK();
+}
 
-    /* Allocate an even number of words to maintain alignment */
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; 
-    if(size <= 2*DSIZE)size= 2*DSIZE;//显式空闲链表前后继
-    char* oldbp = mem_sbrk(0);
-    int alloc=GET_ALLOC(HDRP(oldbp));
-    if ((long)(bp = mem_sbrk(size)) == -1)  
-        return NULL;                                        
+/*
+ * mm_hlock - 钉住句柄块，返回用户数据的地址；无效的句柄返回NULL
+ */
+void *mm_hlock(mm_handle_t h) {
+    char *p = NULL;
+    MM_LOCK();
+    if (h != 0 && h <= H(nhandles) && H(handles)[h-1].locks != HANDLE_FREE) {
+        H(handles)[h-1].locks++;
+        p = HANDLE_BLK(h) + DSIZE;
+    }
+    MM_UNLOCK();
+    return p;
+}
 
-    /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));         /* Free block header */   
-    PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
-    if(!alloc)
-        SET_PREV_FREE(bp);
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+void mm_hunlock(mm_handle_t h) {
+    MM_LOCK();
+    if (h != 0 && h <= H(nhandles) && H(handles)[h-1].locks != HANDLE_FREE
+        && H(handles)[h-1].locks > 0)
+        H(handles)[h-1].locks--;
+    MM_UNLOCK();
+}
 
-    SET_PREV_FREE(NEXT_BLKP(bp));
-    /* Coalesce if the previous block was free */
-    return coalesce(bp);                                          
+static long compact_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
 }
 
 /*
- * coalesce - Boundary tag coalescing. Return ptr to coalesced block
+ * mm_compact - 从上次停下的地方顺着堆走，把每个空闲块后面未被钉住的句柄块移到空闲块处，
+ * 空闲块于是一路向堆尾移动并不断合并。超过budget_ns纳秒时停下返回1，走到堆尾返回0
  */
-static void *coalesce(void *bp) 
-{
-    size_t prev_alloc = !GET_PREV_FREE(bp);
-    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-    size_t size = GET_SIZE(HDRP(bp));
+int mm_compact(long budget_ns) {
+    char *bp;
+    long start = compact_clock();
+    unsigned int n = 0;
+    int more = 0;
 
-    if (prev_alloc && next_alloc) {            /* Case 1 */
-        
+    MM_LOCK();
+    if (H(heap_listp) == NULL) {
+        MM_UNLOCK();
+        return 0;
     }
-
-    else if (prev_alloc && !next_alloc) {      /* Case 2 */
-        delete_stack(NEXT_BLKP(bp));
+    if (S(stats).fast_blocks) /*快速链表中的块看起来是已分配的，挡住空闲块*/
+        consolidate();
+    bp = H(compact_from) ? HANDLE_BLK(H(compact_from)) : H(heap_listp);
+    while (GET_SIZE(HDRP(bp)) > 0) {
+        char *next = NEXT_BLKP(bp);
+        int moved = 0;
+        if (GET_ALLOC(HDRP(bp))) {
+            if (IS_HANDLE_BLK(bp))
+                H(compact_from) = HANDLE_OF(bp);
+            bp = next;
+        } else if (IS_HANDLE_BLK(next) && H(handles)[HANDLE_OF(next)-1].locks == 0) {
+            H(compact_from) = HANDLE_OF(next);
+            bp = compact_move(bp, next);
+            moved = 1;
+        } else {
+            bp = next;
+        }
+        if (budget_ns > 0 && (moved || ++n % COMPACT_CHECK == 0)
+            && compact_clock() - start >= budget_ns) {
+            more = GET_SIZE(HDRP(bp)) > 0;
+            break;
+        }
+    }
+    if (!more)
+        H(compact_from) = 0;
+    MM_UNLOCK();
+    return more;
+}
+
+static void *compact_move(void *bp, void *next) {
+    size_t fsize = GET_SIZE(HDRP(bp));
+    size_t nsize = GET_SIZE(HDRP(next));
+    char *fp;
+
+    delete_stack(bp);
+    /* 空闲块已合并过，前一块是已分配块，不用保留PREV_FREE位 */
+    memmove(bp, next, nsize - WSIZE);
+    PUT(HDRP(bp), PACK(nsize, 1) | 0x4);
+    H(handles)[HANDLE_OF(bp)-1].off = (char*)bp - H(stack_root);
+    if (PROF_LIVE)
+        prof_move(next, bp);
+    S(stats).moves++;
+    S(stats).moved_bytes += nsize;
+
+    fp = (char*)bp + nsize;
+    PUT(HDRP(fp), PACK(fsize, 0));
+    PUT(FTRP(fp), PACK(fsize, 0));
+    SET_PREV_FREE(NEXT_BLKP(fp));
+    PUT_NEXT(fp,NULL);
+    PUT_PREV(fp,NULL);
+    return coalesce(fp);
+}
+
+/*
+ * mm_trim - 堆尾是空闲块时，只留下pad字节（按DSIZE取整，至少是最小块），
+ * 其余还给系统。少于一页不值得还，返回0
+ */
+int mm_trim(size_t pad) {
+    char *end, *bp;
+    size_t size, keep;
+
+    MM_LOCK();
+    if (H(heap_listp) == NULL) {
+        MM_UNLOCK();
+        return 0;
+    }
+    if (S(stats).fast_blocks)
+        consolidate();
+    end = mem_sbrk(0); /*结尾块*/
+    keep = pad ? MAX(ALIGN(pad), 2*DSIZE) : 0;
+    if (!GET_PREV_FREE(end) || pad > MAX_REQUEST
+        || (size = GET_SIZE(HDRP(PREV_BLKP(end)))) < keep + mem_pagesize()) {
+        MM_UNLOCK();
+        return 0;
+    }
+    bp = PREV_BLKP(end);
+    delete_stack(bp);
+    if (keep) {
+        PUT(HDRP(bp), PACK(keep, 0));
+        PUT(FTRP(bp), PACK(keep, 0));
+        add_stack(bp);
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1) | 0x2);
+    } else {
+        PUT(HDRP(bp), PACK(0, 1)); /*这个块的位置成为结尾块*/
+    }
+    mem_sbrk(-(int)(size - keep));
+    S(stats).trimmed_bytes += size - keep;
+    MM_UNLOCK();
+    return 1;
+}
+
+/*
+ * mm_persist_open - 以文件为堆：文件为空时建一个新堆，返回0；
+ * 文件中是保存过的堆时接着用，返回1。已经有堆时返回-1（EBUSY）
+ */
+int mm_persist_open(const char *path) {
+    int existing;
+    MM_LOCK();
+    if (H(heap_listp) != NULL) {
+        MM_UNLOCK();
+        errno = EBUSY;
+        return -1;
+    }
+    if ((existing = mem_init_file(path)) < 0) {
+        MM_UNLOCK();
+        return -1;
+    }
+    H(persist) = 1;
+    if ((existing ? super_load() : mm_init()) < 0) {
+        mem_deinit();
+        H(persist) = 0;
+        H(super) = NULL;
+        H(heap_listp) = NULL;
+        MM_UNLOCK();
+        errno = existing ? EINVAL : ENOMEM;
+        return -1;
+    }
+    MM_UNLOCK();
+    return existing;
+}
+
+/*
+ * mm_persist_sync - 保存状态并把堆写回文件
+ */
+int mm_persist_sync(void) {
+    int ret;
+    MM_LOCK();
+    if (H(super) == NULL) {
+        MM_UNLOCK();
+        errno = EINVAL;
+        return -1;
+    }
+    super_save();
+    ret = mem_sync();
+    MM_UNLOCK();
+    return ret;
+}
+
+/*
+ * mm_persist_close - 保存并解除映射，之后可以再打开另一个（或同一个）文件
+ */
+int mm_persist_close(void) {
+    int ret;
+    MM_LOCK();
+    if (H(super) == NULL) {
+        MM_UNLOCK();
+        errno = EINVAL;
+        return -1;
+    }
+    super_save();
+    ret = mem_sync();
+    if (H(shared)) { /*先放开进程间的锁再解除映射*/
+        shared_unlock();
+        H(shared) = 0;
+    }
+    mem_deinit();
+    H(super) = NULL;
+    H(persist) = 0;
+    H(heap_listp) = NULL;
+    MM_UNLOCK();
+    return ret;
+}
+
+void mm_persist_setroot(void *p) {
+    MM_LOCK();
+    if (H(super))
+        H(super)->root = p ? (char*)p - (char*)H(super) : 0;
+    MM_UNLOCK();
+}
+
+void *mm_persist_root(void) {
+    void *p = NULL;
+    MM_LOCK();
+    if (H(super) && H(super)->root)
+        p = (char*)H(super) + H(super)->root;
+    MM_UNLOCK();
+    return p;
+}
+
+static void super_save(void) {
+    H(super)->size = sizeof(*H(super));
+    H(super)->heap_size = mem_heapsize();
+    H(super)->dv_off = H(dv) ? H(dv) - H(stack_root) : 0;
+    H(super)->st = mm_cur->st;
+    H(super)->magic = SUPER_MAGIC;
+}
+
+static int super_load(void) {
+    struct mm_super *sp = mem_heap_lo();
+    char *lo = (char*)sp;
+    if (mem_heapsize() < SUPER_SIZE || sp->magic != SUPER_MAGIC
+        || sp->size != sizeof(*sp) || sp->heap_size > mem_heapsize())
+        return -1;
+    mm_cur->st = sp->st;
+    if (S(stack_size) > MM_MAX_BINS)
+        return -1;
+    H(super) = sp;
+    /* 与mm_init中的布局相同 */
+    H(stack_top) = lo + SUPER_SIZE;
+    H(stack_root) = H(stack_top) + S(stack_size)*WSIZE + WSIZE;
+    H(heap_listp) = H(stack_top) + S(stack_size)*WSIZE + 4*WSIZE;
+    super_state();
+    prof_rate = params[P_SAMPLE_RATE].value;
+    prof_reset();
+    H(nhandles) = 0;
+    H(handle_free) = 0;
+    H(compact_from) = 0;
+    CTR(memset(&ctrs, 0, sizeof(ctrs)));
+    return 0;
+}
+
+/*
+ * super_state - 文件按段增长，共享时别的进程也会扩展或收缩堆，堆大小以超级块为准
+ */
+static void super_state(void) {
+    long diff = (long)H(super)->heap_size - (long)mem_heapsize();
+    if (diff)
+        mem_sbrk((int)diff);
+    mm_cur->st = H(super)->st;
+    H(dv) = H(super)->dv_off ? H(super)->dv_off + H(stack_root) : NULL;
+}
+
+/*
+ * mm_shared_create - 在memfd中建一个新堆作为本进程的堆，返回memfd。
+ * fork出的子进程直接共用，其他进程拿到描述符后用mm_shared_attach
+ */
+int mm_shared_create(void) {
+    pthread_mutexattr_t attr;
+    int fd;
+    MM_LOCK();
+    if (H(heap_listp) != NULL) {
+        MM_UNLOCK();
+        errno = EBUSY;
+        return -1;
+    }
+    if ((fd = mem_init_shared()) < 0) {
+        MM_UNLOCK();
+        return -1;
+    }
+    H(persist) = 1;
+    if (mm_init() < 0) {
+        mem_deinit();
+        close(fd);
+        H(persist) = 0;
+        H(super) = NULL;
+        H(heap_listp) = NULL;
+        MM_UNLOCK();
+        errno = ENOMEM;
+        return -1;
+    }
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&H(super)->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    super_save();
+    H(shared) = 1;
+    H(shared_gen) = H(super)->gen;
+    shared_lock(); /*与MM_UNLOCK配对*/
+    MM_UNLOCK();
+    return fd;
+}
+
+/*
+ * mm_shared_attach - 映射另一个进程用mm_shared_create建的堆，作为本进程的堆
+ */
+int mm_shared_attach(int fd) {
+    struct mm_super *sp;
+    MM_LOCK();
+    if (H(heap_listp) != NULL) {
+        MM_UNLOCK();
+        errno = EBUSY;
+        return -1;
+    }
+    if (mem_init_fd(fd) <= 0) {
+        MM_UNLOCK();
+        errno = EINVAL;
+        return -1;
+    }
+    sp = mem_heap_lo();
+    if (sp->magic != SUPER_MAGIC || sp->size != sizeof(*sp)) {
+        mem_deinit();
+        MM_UNLOCK();
+        errno = EINVAL;
+        return -1;
+    }
+    H(persist) = 1;
+    pthread_mutex_lock(&sp->lock);
+    super_load();
+    H(shared) = 1;
+    H(shared_gen) = sp->gen;
+    H(shared_depth) = 1; /*已经拿到锁，由MM_UNLOCK放开*/
+    MM_UNLOCK();
+    return 0;
+}
+
+static void shared_lock(void) {
+    if (pthread_mutex_lock(&H(super)->lock) == EOWNERDEAD) /*持锁的进程死了，堆可能不一致，只能继续*/
+        pthread_mutex_consistent(&H(super)->lock);
+    if (H(shared_depth)++ == 0 && H(super)->gen != H(shared_gen))
+        super_state();
+}
+
+static void shared_unlock(void) {
+    if (--H(shared_depth) == 0) {
+        super_save();
+        H(shared_gen) = ++H(super)->gen;
+    }
+    pthread_mutex_unlock(&H(super)->lock);
+}
+
+/*
+ * mm_heap_offset、mm_heap_pointer - 块地址与相对堆开头的偏移互相转换，
+ * 偏移在共享同一个堆（或先后打开同一个文件）的进程之间有效
+ */
+long mm_heap_offset(const void *p) {
+    return p ? (const char*)p - (char*)mem_heap_lo() : 0;
+}
+
+void *mm_heap_pointer(long off) {
+    return off ? (char*)mem_heap_lo() + off : NULL;
+}
+
+/*
+ * mm_heap_create建的堆：struct mm_heap放在自己的memlib区域开头，之后是mm_init建的堆。
+ * 各入口切换本线程的mm_cur和memlib区域，加这个堆的锁后调用do_malloc等。
+ * 不能调用malloc等入口：gcc把它们当作内建函数，认为不读写全局变量，会删掉前后对mm_cur的赋值
+ */
+#define HEAP_ENTER(h) \
+    struct mm_heap *heap_saved = mm_cur; \
+    struct mem_region *mem_saved = mem_region_select((h)->mem); \
+    mm_cur = (h)
+#define HEAP_LEAVE() do { mm_cur = heap_saved; mem_region_select(mem_saved); } while (0)
+
+/*
+ * mm_heap_create - 建一个最多max字节（0为与默认的堆相同）的堆，失败返回NULL
+ */
+struct mm_heap *mm_heap_create(size_t max) {
+    struct mem_region *r, *mem_saved;
+    struct mm_heap *h, *heap_saved;
+    if ((r = mem_region_create(max)) == NULL)
+        return NULL;
+    mem_saved = mem_region_select(r);
+    heap_saved = mm_cur;
+    if ((h = mem_sbrk(ALIGN(sizeof(*h)))) == (void *)-1)
+        goto fail;
+    memset(h, 0, sizeof(*h));
+    h->mem = r;
+#ifndef DRIVER
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&h->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+#endif
+    mm_cur = h;
+    if (mm_init() < 0) {
+        mm_cur = heap_saved;
+        goto fail;
+    }
+    mm_cur = heap_saved;
+    mem_region_select(mem_saved);
+    return h;
+fail:
+    mem_region_select(mem_saved);
+    mem_region_destroy(r);
+    errno = ENOMEM;
+    return NULL;
+}
+
+/*
+ * mm_heap_destroy - 一次释放整个堆：句柄表和memlib区域
+ */
+void mm_heap_destroy(struct mm_heap *h) {
+    struct mm_heap *heap_saved = mm_cur;
+    if (h == NULL || h == &mm_main)
+        return;
+    mm_cur = h;
+    if (H(handles))
+        munmap(H(handles), H(maxhandles) * sizeof(*H(handles)));
+    mm_cur = heap_saved;
+#ifndef DRIVER
+    pthread_mutex_destroy(&h->lock);
+#endif
+    mem_region_destroy(h->mem);
+}
+
+void *mm_heap_malloc(struct mm_heap *h, size_t size) {
+    void *p;
+    HEAP_ENTER(h);
+    MM_LOCK();
+    p = do_malloc(size);
+    MM_UNLOCK();
+    HEAP_LEAVE();
+    return p;
+}
+
+void mm_heap_free(struct mm_heap *h, void *ptr) {
+    HEAP_ENTER(h);
+    MM_LOCK();
+    do_free(ptr);
+    MM_UNLOCK();
+    HEAP_LEAVE();
+}
+
+void *mm_heap_realloc(struct mm_heap *h, void *ptr, size_t size) {
+    void *p = NULL;
+    HEAP_ENTER(h);
+    MM_LOCK();
+    if (ptr == NULL)
+        p = do_malloc(size);
+    else if (size == 0)
+        do_free(ptr);
+    else
+        p = do_realloc(ptr, size);
+    MM_UNLOCK();
+    HEAP_LEAVE();
+    return p;
+}
+
+void mm_heap_stats(struct mm_heap *h, struct mm_stats *st) {
+    HEAP_ENTER(h);
+    mm_stats(st);
+    HEAP_LEAVE();
+}
+
+/*
+ * 区域（arena）：每次从堆中取一块chunk字节的块，在块内移动指针分配，对象不单独释放；
+ * mm_region_reset把所有块一次还给堆（放回分离链表），代价与块数成正比。
+ * 超过块大小1/4的请求单独占一块，挂在当前块之后，不浪费当前块的剩余部分。
+ * 区域本身不加锁，同一时刻只能由一个线程使用；只有取块、还块时加堆的锁
+ */
+#define REGION_CHUNK (16384) /*区域每次从堆中取的字节数（默认值）*/
+struct region_chunk {
+    struct region_chunk *next;
+};
+struct mm_region {
+    struct region_chunk *chunks; /*当前块在最前*/
+    char *cur, *end;             /*当前块中未用的部分*/
+    size_t chunk;                /*每块可用的字节数*/
+    size_t nchunks;              /*从堆中取了的块数*/
+};
+
+/*
+ * mm_region_create - 建一个每次从堆中取chunk字节（0为REGION_CHUNK）的区域，失败返回NULL
+ */
+struct mm_region *mm_region_create(size_t chunk) {
+    struct mm_region *r;
+    if (chunk == 0)
+        chunk = REGION_CHUNK;
+    MM_LOCK();
+    r = do_malloc(sizeof(*r));
+    MM_UNLOCK();
+    if (r == NULL)
+        return NULL;
+    r->chunks = NULL;
+    r->cur = r->end = NULL;
+    r->chunk = ALIGN(chunk);
+    r->nchunks = 0;
+    return r;
+}
+
+/*
+ * region_refill - 当前块放不下size字节：大请求单独取一块，否则取新的当前块
+ */
+static void *region_refill(struct mm_region *r, size_t size) {
+    int big = size > r->chunk / 4;
+    size_t len = big ? size : r->chunk;
+    struct region_chunk *c;
+    if (len > (size_t)UINT32_MAX - sizeof(*c)) /*块大小要放得进WSIZE的头部*/
+        return NULL;
+    MM_LOCK();
+    c = do_malloc(sizeof(*c) + len);
+    MM_UNLOCK();
+    if (c == NULL)
+        return NULL;
+    r->nchunks++;
+    if (big && r->chunks) { /*挂在当前块之后，当前块照用*/
+        c->next = r->chunks->next;
+        r->chunks->next = c;
+        return c + 1;
+    }
+    c->next = r->chunks;
+    r->chunks = c;
+    if (big)
+        return c + 1;
+    r->cur = (char*)(c + 1) + size;
+    r->end = (char*)(c + 1) + len;
+    return c + 1;
+}
+
+/*
+ * mm_region_alloc - 从区域中分配size字节，按ALIGNMENT对齐；失败返回NULL
+ */
+void *mm_region_alloc(struct mm_region *r, size_t size) {
+    char *p = r->cur;
+    if (size > (size_t)UINT32_MAX) /*对齐时不能回绕；块大小也放不进WSIZE的头部*/
+        return NULL;
+    size = size ? ALIGN(size) : ALIGNMENT; /*0字节也给出不同的指针*/
+    if (size <= (size_t)(r->end - p)) {
+        r->cur = p + size;
+        return p;
+    }
+    return region_refill(r, size);
+}
+
+/*
+ * mm_region_reset - 释放区域中分配的全部对象，块都还给堆
+ */
+void mm_region_reset(struct mm_region *r) {
+    struct region_chunk *c, *next;
+    MM_LOCK();
+    for (c = r->chunks; c != NULL; c = next) {
+        next = c->next;
+        do_free(c);
+    }
+    MM_UNLOCK();
+    r->chunks = NULL;
+    r->cur = r->end = NULL;
+}
+
+/*
+ * mm_region_destroy - mm_region_reset之后释放区域本身
+ */
+void mm_region_destroy(struct mm_region *r) {
+    if (r == NULL)
+        return;
+    mm_region_reset(r);
+    MM_LOCK();
+    do_free(r);
+    MM_UNLOCK();
+}
+
+/*
+ * mm_region_chunks - 区域建立以来从堆中取过的块数
+ */
+size_t mm_region_chunks(struct mm_region *r) {
+    return r->nchunks;
+}
+
+/*
+ * Return whether the pointer is in the heap.
+ * May be useful for debugging.
+ */
+static int in_heap(const void *p) {
+    return p <= mem_heap_hi() && p >= mem_heap_lo();
+}
+
+/*
+ * Return whether the pointer is aligned.
+ * May be useful for debugging.
+ */
+static int aligned(const void *p) {
+    return (size_t)ALIGN(p) == (size_t)p;
+}
+
+/*
+ * mm_checkheap - 检查堆和各组、快速链表、dv、句柄表是否一致，发现错误时打印并退出：
+ * 堆中的块对齐、头尾一致、PREV_FREE位正确、没有相邻的空闲块；
+ * 各组中的块空闲、属于该组、不是dv，块数和字节数与统计一致，bin_map与非空的组一致；
+ * 链表组的前后继对应，最底下的块是bin_tail；树组满足键的顺序和堆序，
+ * 大小树的父结点偏移、地址树的子树最大值正确；快速链表中的块保持已分配的样子且大小对应；
+ * dv空闲且不在任何组中；句柄表中在用的句柄指向带MOVABLE位、记着该句柄的已分配块
+ */
+#define CHECK(cond, msg, bp) do { \
+    if (!(cond)) { \
+        printf("mm_checkheap(%d): %s at %p\n", lineno, msg, (void*)(bp)); \
+        exit(-1); \
+    } \
+} while (0)
+
+/// @brief 检查第i组中的块bp
+static void check_free(int lineno, unsigned int i, char *bp) {
+    CHECK(in_heap(bp) && aligned(bp), "free block outside the heap", bp);
+    CHECK(!GET_ALLOC(HDRP(bp)), "allocated block in a bin", bp);
+    CHECK(bp != H(dv), "dv in a bin", bp);
+    CHECK(get_index(GET_SIZE(HDRP(bp))) == i, "block in the wrong bin", bp);
+}
+
+/// @brief 检查第i组中t为根的子树，lo、hi为键的下界、上界（stack_root为没有），up为父结点
+/// @return 子树的块数，bytes累加块的字节数
+static size_t check_tree(int lineno, unsigned int i, char *t, char *lo, char *hi, char *up, size_t *bytes) {
+    int by_addr = S(bin_policy)[i] == POL_ADDR;
+    char *l, *r;
+    size_t size;
+    if (t == H(stack_root))
+        return 0;
+    check_free(lineno, i, t);
+    size = GET_SIZE(HDRP(t));
+    *bytes += size;
+    if (lo != H(stack_root))
+        CHECK(by_addr ? lo < t : TREE_LESS(lo, t), "tree out of order", t);
+    if (hi != H(stack_root))
+        CHECK(by_addr ? t < hi : TREE_LESS(t, hi), "tree out of order", t);
+    if (up != H(stack_root))
+        CHECK(TREE_PRIO(t) < TREE_PRIO(up), "tree out of heap order", t);
+    l = TREE_NODE(TREE_LEFT(t));
+    r = TREE_NODE(TREE_RIGHT(t));
+    if (!by_addr)
+        CHECK(TREE_NODE(TREE_UP(t)) == up, "wrong parent in size tree", t);
+    else if (size > 2*DSIZE)
+        CHECK(TREE_MAX(t) == MAX(size, MAX(tree_max(l), tree_max(r))), "wrong subtree max", t);
+    return 1 + check_tree(lineno, i, l, lo, t, t, bytes) + check_tree(lineno, i, r, t, hi, t, bytes);
+}
+
+void mm_checkheap(int lineno) {
+    size_t heap_free = 0, bin_free = 0, size;
+    unsigned int prev_alloc = 1;
+    char *bp;
+
+    MM_LOCK();
+    if (H(heap_listp) == NULL) {
+        MM_UNLOCK();
+        return;
+    }
+
+    /* 堆中的块 */
+    for (bp = H(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        unsigned int alloc = GET_ALLOC(HDRP(bp));
+        size = GET_SIZE(HDRP(bp));
+        CHECK(aligned(bp), "misaligned block", bp);
+        CHECK(size % DSIZE == 0 && (size >= 2*DSIZE || bp == H(heap_listp)), "bad block size", bp);
+        CHECK(in_heap(HDRP(NEXT_BLKP(bp))), "block runs past the heap", bp);
+        CHECK((GET_PREV_FREE(NEXT_BLKP(bp)) != 0) == (alloc == 0), "wrong prev-free bit", NEXT_BLKP(bp));
+        if (!alloc) {
+            CHECK(GET(HDRP(bp)) == GET(FTRP(bp)), "header and footer differ", bp);
+            CHECK(prev_alloc, "fail coaleacing", bp);
+            heap_free++;
+        }
+        prev_alloc = alloc;
+    }
+    CHECK((char*)bp - 1 == (char*)mem_heap_hi(), "epilogue is not at the end of the heap", bp);
+
+    /* 各组 */
+    for (unsigned int i = 0; i < S(stack_size); i++) {
+        size_t n = 0, bytes = 0;
+        char *top = GET_TOP(i);
+        CHECK((S(bin_map) >> i & 1) == (top != H(stack_root)), "bin_map disagrees with the bin", top);
+        if (S(bin_policy)[i] >= POL_ADDR) {
+            n = check_tree(lineno, i, top, H(stack_root), H(stack_root), H(stack_root), &bytes);
+        } else {
+            for (bp = top; bp != H(stack_root); bp = GET_PREV(bp)) {
+                check_free(lineno, i, bp);
+                CHECK(++n <= S(stats).bin_blocks[i], "cycle in a list", bp);
+                bytes += GET_SIZE(HDRP(bp));
+                if (GET_PREV(bp) == H(stack_root))
+                    CHECK(S(bin_tail)[i] == bp - H(stack_root), "bin_tail is not the bottom block", bp);
+                else
+                    CHECK(GET_NEXT(GET_PREV(bp)) == bp, "prev and next links disagree", bp);
+            }
+        }
+        CHECK(n == S(stats).bin_blocks[i] && bytes == S(stats).bin_bytes[i], "bin disagrees with its counts", top);
+        bin_free += n;
+    }
+
+    /* dv：空闲、不在组中，所以堆中的空闲块恰好比组中的多一个 */
+    if (H(dv)) {
+        CHECK(in_heap(H(dv)) && !GET_ALLOC(HDRP(H(dv))), "dv is not a free block", H(dv));
+        bin_free++;
+    }
+    CHECK(heap_free == bin_free, "free blocks missing from the bins", H(heap_listp));
+
+    /* 快速链表：块在堆中仍像已分配的，大小对应所在的链表 */
+    {
+        size_t n = 0, bytes = 0;
+        for (unsigned int i = 0; i < FAST_BINS; i++) {
+            for (int off = S(fast_top)[i]; off; off = FAST_NEXT(bp)) {
+                bp = off + H(stack_root);
+                CHECK(in_heap(bp) && aligned(bp), "fast block outside the heap", bp);
+                CHECK(GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(bp)) == i * DSIZE, "bad fast block", bp);
+                CHECK(++n <= S(stats).fast_blocks, "cycle in a fast bin", bp);
+                bytes += i * DSIZE;
+            }
+        }
+        CHECK(n == S(stats).fast_blocks && bytes == S(stats).fast_bytes, "fast bins disagree with their counts", H(heap_listp));
+    }
+
+    /* 句柄表：在用的句柄指向记着它的可移动块，空闲槽都在空闲链表中 */
+    {
+        unsigned int nfree = 0;
+        for (mm_handle_t h = 1; h <= H(nhandles); h++) {
+            if (H(handles)[h-1].locks == HANDLE_FREE)
+                continue;
+            bp = HANDLE_BLK(h);
+            CHECK(in_heap(bp) && aligned(bp), "handle offset outside the heap", bp);
+            CHECK(GET_ALLOC(HDRP(bp)) && GET_MOVABLE(HDRP(bp)) && HANDLE_OF(bp) == h, "handle does not point at its block", bp);
+        }
+        for (mm_handle_t h = H(handle_free); h; h = H(handles)[h-1].off) {
+            CHECK(h <= H(nhandles) && H(handles)[h-1].locks == HANDLE_FREE, "bad free handle slot", H(heap_listp));
+            CHECK(++nfree <= H(nhandles), "cycle in the free handle slots", H(heap_listp));
+        }
+        for (mm_handle_t h = 1; h <= H(nhandles); h++)
+            nfree -= H(handles)[h-1].locks == HANDLE_FREE;
+        CHECK(nfree == 0, "free handle slot missing from the free list", H(heap_listp));
+    }
+    MM_UNLOCK();
+}
+#undef CHECK
+/*
+ * prof_alloc - 从记录区分配，用完返回NULL
+ */
+static void *prof_alloc(size_t size) {
+    void *p;
+    size = ALIGN(size);
+    if (prof_arena == NULL || prof_brk + size > prof_arena + PROF_ARENA)
+        return NULL;
+    p = prof_brk;
+    prof_brk += size;
+    return p;
+}
+
+static void prof_reset(void) {
+    prof_live = 0;
+    prof_free_list = NULL;
+    prof_samples = NULL;
+    prof_stacks = NULL;
+    prof_left = prof_rate;
+}
+
+/*
+ * prof_setup - 第一次采样时才准备记录区和散列表，没有采样的运行不必清零它们
+ */
+static int prof_setup(void) {
+    if (prof_arena == NULL) {
+        prof_arena = mmap(NULL, PROF_ARENA, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (prof_arena == MAP_FAILED) {
+            prof_arena = NULL;
+            prof_rate = 0;
+            return -1;
+        }
+    }
+    prof_brk = prof_arena;
+    prof_samples = prof_alloc(PROF_SAMPLE_BUCKETS * sizeof(*prof_samples));
+    prof_stacks = prof_alloc(PROF_STACK_BUCKETS * sizeof(*prof_stacks));
+    memset(prof_samples, 0, PROF_SAMPLE_BUCKETS * sizeof(*prof_samples));
+    memset(prof_stacks, 0, PROF_STACK_BUCKETS * sizeof(*prof_stacks));
+    return 0;
+}
+
+/*
+ * prof_next - 下一次采样前要分配的字节数，服从均值为prof_rate的指数分布
+ */
+static long prof_next(void) {
+    double u;
+    prof_rand ^= prof_rand << 13;
+    prof_rand ^= prof_rand >> 7;
+    prof_rand ^= prof_rand << 17;
+    u = ((prof_rand >> 11) + 1) * (1.0 / 9007199254740992.0); /* (0,1] */
+    return (long)(-log(u) * prof_rate) + 1;
+}
+
+static unsigned int prof_hash_ptr(const void *p) {
+    return (unsigned int)(((uintptr_t)p >> 3) * 2654435761U) % PROF_SAMPLE_BUCKETS;
+}
+
+static void prof_sample(void *bp, size_t size) {
+    void *pc[PROF_DEPTH + 1];
+    struct prof_stack *st;
+    struct prof_sample *sp;
+    uint64_t h = 1469598103934665603ULL;
+    int depth, i;
+
+    prof_left = prof_next();
+    if (prof_busy || (prof_samples == NULL && prof_setup() < 0))
+        return;
+    prof_busy = 1;
+    /* 只跳过prof_sample本身；malloc等分配器的栈帧由pprof按名字去掉 */
+    depth = backtrace(pc, PROF_DEPTH + 1) - 1;
+    if (depth < 0)
+        depth = 0;
+    for (i = 0; i < depth; i++)
+        h = (h ^ (uintptr_t)pc[i + 1]) * 1099511628211ULL;
+    for (st = prof_stacks[h % PROF_STACK_BUCKETS]; st; st = st->next)
+        if (st->hash == h && st->depth == depth
+            && memcmp(st->pc, pc + 1, depth * sizeof(void *)) == 0)
+            break;
+    if (st == NULL && (st = prof_alloc(sizeof(*st))) != NULL) {
+        memset(st, 0, sizeof(*st));
+        st->hash = h;
+        st->depth = depth;
+        memcpy(st->pc, pc + 1, depth * sizeof(void *));
+        st->next = prof_stacks[h % PROF_STACK_BUCKETS];
+        prof_stacks[h % PROF_STACK_BUCKETS] = st;
+    }
+    if ((sp = prof_free_list) != NULL)
+        prof_free_list = sp->next;
+    else
+        sp = prof_alloc(sizeof(*sp));
+    if (st == NULL || sp == NULL) { /*记录区已满*/
+        prof_busy = 0;
+        return;
+    }
+    st->inuse_objs++;
+    st->inuse_bytes += size;
+    st->alloc_objs++;
+    st->alloc_bytes += size;
+    sp->bp = bp;
+    sp->size = size;
+    sp->stack = st;
+    sp->next = prof_samples[prof_hash_ptr(bp)];
+    prof_samples[prof_hash_ptr(bp)] = sp;
+    prof_live++;
+    prof_busy = 0;
+}
+
+/*
+ * prof_unlink - 从散列表中取出bp的采样记录，没有则返回NULL
+ */
+static struct prof_sample *prof_unlink(const void *bp) {
+    struct prof_sample **pp = &prof_samples[prof_hash_ptr(bp)];
+    for (; *pp; pp = &(*pp)->next) {
+        if ((*pp)->bp == bp) {
+            struct prof_sample *sp = *pp;
+            *pp = sp->next;
+            return sp;
+        }
+    }
+    return NULL;
+}
+
+static void prof_free(void *bp) {
+    struct prof_sample *sp = prof_unlink(bp);
+    if (sp == NULL)
+        return;
+    sp->stack->inuse_objs--;
+    sp->stack->inuse_bytes -= sp->size;
+    sp->next = prof_free_list;
+    prof_free_list = sp;
+    prof_live--;
+}
+
+static void prof_move(void *from, void *to) {
+    struct prof_sample *sp = prof_unlink(from);
+    if (sp == NULL)
+        return;
+    sp->bp = to;
+    sp->next = prof_samples[prof_hash_ptr(to)];
+    prof_samples[prof_hash_ptr(to)] = sp;
+}
+
+/*
+ * mm_heapprof_dump - 以pprof的heap_v2文本格式输出存活的采样块（按调用栈汇总），
+ * 最后附上/proc/self/maps以便符号化。只用write，不调用malloc
+ */
+int mm_heapprof_dump(int fd) {
+    char buf[64 + PROF_DEPTH * 20];
+    long objs = 0, bytes = 0, aobjs = 0, abytes = 0;
+    struct prof_stack *st;
+    unsigned int b;
+    int n, i, mfd;
+
+    MM_LOCK();
+    prof_busy = 1;
+    for (b = 0; prof_stacks && b < PROF_STACK_BUCKETS; b++) {
+        for (st = prof_stacks[b]; st; st = st->next) {
+            objs += st->inuse_objs;
+            bytes += st->inuse_bytes;
+            aobjs += st->alloc_objs;
+            abytes += st->alloc_bytes;
+        }
+    }
+    n = snprintf(buf, sizeof(buf), "heap profile: %ld: %ld [%ld: %ld] @ heap_v2/%ld\n",
+                 objs, bytes, aobjs, abytes, prof_rate);
+    if (write(fd, buf, n) != n)
+        goto fail;
+    for (b = 0; prof_stacks && b < PROF_STACK_BUCKETS; b++) {
+        for (st = prof_stacks[b]; st; st = st->next) {
+            n = snprintf(buf, sizeof(buf), "%ld: %ld [%ld: %ld] @",
+                         st->inuse_objs, st->inuse_bytes,
+                         st->alloc_objs, st->alloc_bytes);
+            for (i = 0; i < st->depth; i++)
+                n += snprintf(buf + n, sizeof(buf) - n, " %p", st->pc[i]);
+            n += snprintf(buf + n, sizeof(buf) - n, "\n");
+            if (write(fd, buf, n) != n)
+                goto fail;
+        }
+    }
+    n = snprintf(buf, sizeof(buf), "\nMAPPED_LIBRARIES:\n");
+    if (write(fd, buf, n) != n)
+        goto fail;
+    if ((mfd = open("/proc/self/maps", O_RDONLY)) >= 0) {
+        while ((n = read(mfd, buf, sizeof(buf))) > 0)
+            if (write(fd, buf, n) != n)
+                break;
+        close(mfd);
+    }
+    prof_busy = 0;
+    MM_UNLOCK();
+    return 0;
+fail:
+    prof_busy = 0;
+    MM_UNLOCK();
+    return -1;
+}
+
+/*
+ * mm_counters - 返回热路径计数；没有编译进来时返回-1
+ */
+int mm_counters(struct mm_counters *c) {
+#ifdef MM_COUNTERS
+    MM_LOCK();
+    *c = ctrs;
+    MM_UNLOCK();
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+#ifdef MM_EVENTS
+/*
+ * ev_new - 为本线程建立缓冲区（在堆外mmap），无锁地挂到全局链表上
+ */
+static struct ev_ring *ev_new(void) {
+    static __thread int failed;
+    struct ev_ring *r;
+    if (failed)
+        return NULL;
+    r = mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (r == MAP_FAILED) {
+        failed = 1;
+        return NULL;
+    }
+    r->tid = syscall(SYS_gettid);
+    r->next = __atomic_load_n(&ev_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&ev_rings, &r->next, r, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return ev_mine = r;
+}
+
+static void ev_record(int op, size_t size, const void *addr, uint64_t t0) {
+    struct ev_ring *r = ev_mine;
+    struct mm_event *e;
+    uint64_t head, now;
+    if (r == NULL && (r = ev_new()) == NULL)
+        return;
+    head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= EV_RING) {
+        r->dropped++;
+        return;
+    }
+    now = ev_tsc();
+    e = &r->ev[head & (EV_RING - 1)];
+    e->tsc = now;
+    e->addr = (uintptr_t)addr;
+    e->size = size > UINT32_MAX ? UINT32_MAX : size;
+    e->cycles = t0 == 0 ? 0 : now - t0 > UINT32_MAX ? UINT32_MAX : now - t0;
+    e->tid = r->tid;
+    e->op = op;
+    if (op == MM_EV_FREE || op == MM_EV_EXTEND) {
+        e->bin = size ? get_index(size) : EV_NOBIN;
+        e->search = 0;
+    } else {
+        e->bin = ev_bin;
+        e->search = ev_search > UINT16_MAX ? UINT16_MAX : ev_search;
+    }
+    /*事件内容写完后才发布head*/
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int mm_events_enable(int on) {
+    ev_on = on;
+    return 0;
+}
+
+/*
+ * mm_events_drain - 从各线程的缓冲区取出至多max条事件；同一时刻只能有一个读者
+ */
+size_t mm_events_drain(struct mm_event *buf, size_t max) {
+    struct ev_ring *r;
+    size_t n = 0;
+    for (r = __atomic_load_n(&ev_rings, __ATOMIC_ACQUIRE); r && n < max; r = r->next) {
+        uint64_t tail = r->tail;
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        while (tail != head && n < max)
+            buf[n++] = r->ev[tail++ & (EV_RING - 1)];
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+/*
+ * mm_events_dump - 取出全部事件写入fd；只用write，可以在信号处理函数中调用
+ */
+long mm_events_dump(int fd) {
+    struct ev_ring *r;
+    long total = 0;
+    for (r = __atomic_load_n(&ev_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        uint64_t tail = r->tail;
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            /*环形缓冲区中连续的一段*/
+            uint64_t i = tail & (EV_RING - 1);
+            uint64_t n = head - tail < EV_RING - i ? head - tail : EV_RING - i;
+            ssize_t len = n * sizeof(struct mm_event);
+            if (write(fd, &r->ev[i], len) != len)
+                return -1;
+            tail += n;
+            total += n;
+            __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+    return total;
+}
+
+unsigned long mm_events_dropped(void) {
+    struct ev_ring *r;
+    unsigned long n = 0;
+    for (r = __atomic_load_n(&ev_rings, __ATOMIC_ACQUIRE); r; r = r->next)
+        n += r->dropped;
+    return n;
+}
+#else
+int mm_events_enable(int on) {
+    errno = ENOSYS;
+    return -1;
+}
+size_t mm_events_drain(struct mm_event *buf, size_t max) { return 0; }
+long mm_events_dump(int fd) { return 0; }
+unsigned long mm_events_dropped(void) { return 0; }
+#endif /* MM_EVENTS */
+
+/*
+ * mm_stats - 返回增量维护的统计；只需扫描各组的计数，最大空闲块只遍历最高的非空组
+ */
+void mm_stats(struct mm_stats *st) {
+    MM_LOCK();
+    *st = S(stats);
+    st->heap_size = H(heap_listp) ? mem_heapsize() : 0;
+    for(unsigned int i=0;i<S(stats).nbins;i++){
+        st->free_bytes += S(stats).bin_bytes[i];
+        st->free_blocks += S(stats).bin_blocks[i];
+    }
+    st->free_bytes += S(stats).fast_bytes;
+    st->free_blocks += S(stats).fast_blocks;
+    if (H(dv)) {
+        st->free_bytes += GET_SIZE(HDRP(H(dv)));
+        st->free_blocks++;
+    }
+    for(int i=(int)S(stats).nbins-1;i>=0;i--){
+        if(S(stats).bin_blocks[i]==0)
+            continue;
+        st->largest_free = bin_largest(i);
+        break;
+    }
+    if (H(dv) && GET_SIZE(HDRP(H(dv))) > st->largest_free)
+        st->largest_free = GET_SIZE(HDRP(H(dv)));
+    MM_UNLOCK();
+}
+
+/*
+ * bin_largest - 第i组中最大的空闲块：大小树取最右的块，其余遍历
+ */
+static size_t bin_largest(unsigned int i) {
+    size_t largest = 0;
+    char *bp = GET_TOP(i);
+    if (S(bin_policy)[i] == POL_SIZE) {
+        if (bp == H(stack_root))
+            return 0;
+        while (TREE_NODE(TREE_RIGHT(bp)) != H(stack_root))
+            bp = TREE_NODE(TREE_RIGHT(bp));
+        return GET_SIZE(HDRP(bp));
+    }
+    if (S(bin_policy)[i] == POL_ADDR)
+        return tree_max(bp);
+    for (; bp!=H(stack_root); bp = GET_PREV(bp))
+        if (GET_SIZE(HDRP(bp)) > largest)
+            largest = GET_SIZE(HDRP(bp));
+    return largest;
+}
+
+/*
+ * mm_heapinfo - 遍历各组空闲链表，统计空闲块数量、总大小、最大空闲块和最长链
+ */
+void mm_heapinfo(struct mm_heapinfo *info) {
+    memset(info, 0, sizeof(*info));
+    MM_LOCK();
+    if (H(heap_listp) == NULL) {
+        MM_UNLOCK();
+        return;
+    }
+    info->heap_size = mem_heapsize();
+    for(unsigned int i=0;i<S(stack_size);i++){
+        size_t chain = 0;
+        if(S(bin_policy)[i]>=POL_ADDR){/*树组：块数和字节数取增量统计*/
+            size_t size = bin_largest(i);
+            if (size > info->largest_free)
+                info->largest_free = size;
+            info->free_bytes += S(stats).bin_bytes[i];
+            chain = S(stats).bin_blocks[i];
+        }
+        for (char *bp = GET_TOP(i); S(bin_policy)[i]<POL_ADDR && bp!=H(stack_root); bp = GET_PREV(bp)) {
+            size_t size = GET_SIZE(HDRP(bp));
+            info->free_bytes += size;
+            if (size > info->largest_free)
+                info->largest_free = size;
+            chain++;
+        }
+        info->free_blocks += chain;
+        if (chain > info->longest_chain)
+            info->longest_chain = chain;
+    }
+    for(unsigned int i=0;i<FAST_BINS;i++){/*快速链表中的块也算空闲块*/
+        size_t chain = 0;
+        for (int off = S(fast_top)[i]; off; off = FAST_NEXT(off + H(stack_root)))
+            chain++;
+        info->free_bytes += chain * i * DSIZE;
+        info->free_blocks += chain;
+        if (chain && i * DSIZE > info->largest_free)
+            info->largest_free = i * DSIZE;
+        if (chain > info->longest_chain)
+            info->longest_chain = chain;
+    }
+    if (H(dv)) {
+        info->free_bytes += GET_SIZE(HDRP(H(dv)));
+        info->free_blocks++;
+        if (GET_SIZE(HDRP(H(dv))) > info->largest_free)
+            info->largest_free = GET_SIZE(HDRP(H(dv)));
+    }
+    MM_UNLOCK();
+}
+
+/* 
+ * extend_heap - Extend heap with free block and return its block pointer
+ */
+static void *extend_heap(size_t words) 
+{
+    char *bp;
+    size_t size;
+
+    /* Allocate an even number of words to maintain alignment */
+    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; 
+    if(size <= 2*DSIZE)size= 2*DSIZE;//显式空闲链表前后继
+    char* oldbp = mem_sbrk(0);
+    int alloc=!GET_PREV_FREE(oldbp); /*结尾块的PREV_FREE位记录最后一块是否空闲*/
+    if ((long)(bp = mem_sbrk(size)) == -1)  
+        return NULL;                                        
+    S(stats).extends++;
+    CTR(ctrs.extends++);
+    EV_EXTEND(bp, size);
+
+    /* Initialize free block header/footer and the epilogue header */
+    PUT(HDRP(bp), PACK(size, 0));         /* Free block header */   
+    PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
+    if(!alloc)
+        SET_PREV_FREE(bp);
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+
+    SET_PREV_FREE(NEXT_BLKP(bp));
+    /* Coalesce if the previous block was free */
+    return coalesce(bp);                                          
+}
+
+/*
+ * coalesce - Boundary tag coalescing. Return ptr to coalesced block
+ */
+static void *coalesce(void *bp) 
+{
+    size_t prev_alloc = !GET_PREV_FREE(bp);
+    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (prev_alloc && next_alloc) {            /* Case 1 */
+        CTR(ctrs.coalesce[0]++);
+        
+    }
+
+    else if (prev_alloc && !next_alloc) {      /* Case 2 */
+        CTR(ctrs.coalesce[1]++);
+        S(stats).coalesces++;
+        delete_stack(NEXT_BLKP(bp));
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
         PUT(HDRP(bp), PACK(size, 0));
         PUT(FTRP(bp), PACK(size,0));
     }
     else if (!prev_alloc && next_alloc) {      /* Case 3 */
+        CTR(ctrs.coalesce[2]++);
+        S(stats).coalesces++;
         delete_stack(PREV_BLKP(bp));
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
         PUT(FTRP(bp), PACK(size, 0));
@@ -332,6 +2397,8 @@ static void *coalesce(void *bp)
         bp = PREV_BLKP(bp);
     }
     else {                                     /* Case 4 */
+        CTR(ctrs.coalesce[3]++);
+        S(stats).coalesces += 2;
         delete_stack(PREV_BLKP(bp));
         delete_stack(NEXT_BLKP(bp));
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
@@ -353,44 +2420,178 @@ static void place(void *bp, size_t asize)
 {
     size_t csize = GET_SIZE(HDRP(bp));   
     delete_stack(bp);
-    if ((csize - asize) >= (2*DSIZE)) { /*分配后还可分割*/
+    S(stats).alloc_blocks++;
+    if ((csize - asize) >= S(split_min)) { /*分配后还可分割*/
+        S(stats).alloc_bytes += asize;
+        S(stats).splits++;
+        CTR(ctrs.splits++);
         PUT(HDRP(bp), PACK(asize, 1));
         bp = NEXT_BLKP(bp);
         PUT(HDRP(bp), PACK(csize-asize, 0));
         PUT(FTRP(bp), PACK(csize-asize, 0));
+        if (asize <= S(dv_max) && (H(dv) == NULL || GET_SIZE(HDRP(H(dv))) < csize - asize)) {
+            if (H(dv))
+                add_stack(H(dv));
+            H(dv) = bp;
+            return;
+        }
         coalesce(bp);
 
     }
     else { /*分配后不可分割*/
+        S(stats).alloc_bytes += csize;
+        CTR(ctrs.unsplit++; ctrs.exact += csize == asize);
         PUT(HDRP(bp), PACK(csize, 1));
         RM_PREV_FREE(NEXT_BLKP(bp));
     }
 }
 
+/*
+ * place_high - 与place相同，但块放在高地址一端：低地址一端的剩余部分保持空闲，
+ * 留在原来的位置，它的头部不动，只改大小
+ */
+static void *place_high(void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+    if ((csize - asize) < S(split_min)) {
+        place(bp, asize);
+        return bp;
+    }
+    delete_stack(bp);
+    S(stats).alloc_blocks++;
+    S(stats).alloc_bytes += asize;
+    S(stats).splits++;
+    CTR(ctrs.splits++);
+    PUT(HDRP(bp), PACK(csize-asize, 0) | (GET(HDRP(bp)) & 0x2));
+    PUT(FTRP(bp), PACK(csize-asize, 0));
+    add_stack(bp);
+    bp = NEXT_BLKP(bp);
+    PUT(HDRP(bp), PACK(asize, 1) | 0x2); /*前一块空闲*/
+    RM_PREV_FREE(NEXT_BLKP(bp));
+    return bp;
+}
+
 /* 
  * find_fit - Find a fit for a block with asize bytes 
  */
 static void *find_fit(size_t asize)
 {
-    /* First-fit search */
+    /* 链表组和地址树组首次适配，大小树组best fit */
     void *bp;
     unsigned int index = get_index(asize);
-    for(unsigned int i=index;i<stack_size;i++){
-        for (bp = GET_TOP(i); bp!=stack_root; bp = GET_PREV(bp)) {
+    unsigned int n = 0; /*检查过的空闲块数，供事件记录*/
+    for(unsigned int i=index;i<S(stack_size);i++){
+        if (i >= S(tree_bin))
+            return find_fit_tree(asize, i, index, n);
+        if (!S(policy_lifo) && S(bin_policy)[i] == POL_ADDR) {
+            if ((bp = tree_first_fit(GET_TOP(i), asize, &n)) != NULL) {
+                EV_FIT(i, n);
+                CTR_FIT(n, i - index + 1, 1);
+                return bp;
+            }
+            continue;
+        }
+        for (bp = GET_TOP(i); bp!=H(stack_root); bp = GET_PREV(bp)) {
+            n++;
             if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp)))) {
+                EV_FIT(i, n);
+                CTR_FIT(n, i - index + 1, 1);
                 return bp;/*fit*/
             }
         }
     }
+    EV_FIT(EV_NOBIN, n);
+    CTR_FIT(n, S(stack_size) - index, 0);
     return NULL; /* No fit */
 }
+
+static void *find_fit_tree(size_t asize, unsigned int index, unsigned int first, unsigned int n)
+{
+    char *t, *best = NULL;
+    unsigned int map;
+    for (t = GET_TOP(index); t != H(stack_root); n++) {
+        if (asize <= GET_SIZE(HDRP(t))) {
+            best = t;
+            t = TREE_NODE(TREE_LEFT(t));
+        } else {
+            t = TREE_NODE(TREE_RIGHT(t));
+        }
+    }
+    if (best == NULL) {
+        /*更高的组中的块都比asize大，取其中最小的*/
+        map = index + 1 < 32 ? S(bin_map) >> (index + 1) << (index + 1) : 0;
+        if (map == 0) {
+            EV_FIT(EV_NOBIN, n);
+            CTR_FIT(n, S(stack_size) - first, 0);
+            return NULL;
+        }
+        index = __builtin_ctz(map);
+        for (best = GET_TOP(index); TREE_NODE(TREE_LEFT(best)) != H(stack_root); n++)
+            best = TREE_NODE(TREE_LEFT(best));
+        n++;
+    }
+    EV_FIT(index, n);
+    CTR_FIT(n, index - first + 1, 1);
+    return best;
+}
+
+/*
+ * find_fit_rt - 按幂分组中的块可能小于asize，只有从下一组开始才一定满足；
+ * 在位图中找到第一个这样的非空组，取其栈顶块。没有时再看本组的栈顶块（只看一个）
+ */
+static void *find_fit_rt(size_t asize)
+{
+    void *bp;
+    unsigned int index = get_index(asize);
+    unsigned int start = index;
+    unsigned int map;
+    if (index >= S(stack_base) && asize > (1U << (S(stack_min) + index - S(stack_base))) + DSIZE)
+        start = index + 1;
+    map = start < 32 ? S(bin_map) >> start << start : 0;
+    if (map) {
+        unsigned int i = __builtin_ctz(map);
+        EV_FIT(i, 1);
+        CTR_FIT(1, 1, 1);
+        return GET_TOP(i);
+    }
+    if (start != index && (S(bin_map) >> index & 1)) {
+        bp = GET_TOP(index);
+        if (asize <= GET_SIZE(HDRP(bp))) {
+            EV_FIT(index, 1);
+            CTR_FIT(1, 2, 1);
+            return bp;
+        }
+    }
+    EV_FIT(EV_NOBIN, 0);
+    CTR_FIT(0, 1, 0);
+    return NULL;
+}
 static void add_stack(void *bp){
     int index = get_index(GET_SIZE(HDRP(bp)));
+    S(stats).bin_bytes[index] += GET_SIZE(HDRP(bp));
+    S(stats).bin_blocks[index]++;
+    S(bin_map) |= 1U << index;
+    if((unsigned int)index>=S(tree_bin)){
+        tree_insert(TREE_ROOT(index),bp);
+        return;
+    }
+    if(!S(policy_lifo) && S(bin_policy)[index]==POL_ADDR){
+        addr_insert(TREE_ROOT(index),bp);
+        return;
+    }
     char* top_blk=GET_TOP(index);
-    if(top_blk==stack_root){/*如果待添加的栈是空的*/
+    if(top_blk==H(stack_root)){/*如果待添加的栈是空的*/
         SET_TOP(bp,index);
         PUT_PREV(bp,top_blk);
         PUT_NEXT(bp, NULL);
+        S(bin_tail)[index] = (char*)bp - H(stack_root);
+    }
+    else if(!S(policy_lifo) && S(bin_policy)[index]==POL_FIFO){/*加到最底下，最后才被找到*/
+        char* bottom=S(bin_tail)[index]+H(stack_root);
+        PUT_PREV(bp,H(stack_root));
+        PUT_NEXT(bp,bottom);
+        PUT_PREV(bottom,bp);
+        S(bin_tail)[index] = (char*)bp - H(stack_root);
     }
     else{/*如果待添加的栈非空*/
         PUT_NEXT(top_blk,bp);
@@ -400,24 +2601,212 @@ static void add_stack(void *bp){
     }
 }
 static void delete_stack(void *bp){
+    if(bp==H(dv)){/*指定受害者不在组中*/
+        H(dv)=NULL;
+        return;
+    }
     int index = get_index(GET_SIZE(HDRP(bp)));
+    S(stats).bin_bytes[index] -= GET_SIZE(HDRP(bp));
+    S(stats).bin_blocks[index]--;
+    if((unsigned int)index>=S(tree_bin) || (!S(policy_lifo) && S(bin_policy)[index]==POL_ADDR)){
+        if((unsigned int)index>=S(tree_bin))
+            tree_delete(TREE_ROOT(index),bp);
+        else
+            addr_delete(TREE_ROOT(index),bp);
+        if(GET_TOP(index)==H(stack_root))
+            S(bin_map) &= ~(1U << index);
+        return;
+    }
     char* top_blk=GET_TOP(index);
     if(bp==top_blk){/*如果待删除的块是栈顶*/
         char* prev_blk=GET_PREV(bp);
         SET_TOP(prev_blk,index);
         PUT_NEXT(prev_blk,NULL);
+        if(prev_blk==H(stack_root))/*栈空了*/
+            S(bin_map) &= ~(1U << index);
     }
     else{/*如果待删除的块不是栈顶*/
         char* next_block=GET_NEXT(bp);
         char* prev_block=GET_PREV(bp);
+        if(prev_block==H(stack_root))/*删除的是最底下的块*/
+            S(bin_tail)[index] = next_block - H(stack_root);
         PUT_NEXT(prev_block,next_block);
         if(next_block)
             PUT_PREV(next_block,prev_block);   
     }
 }
+
+/*
+ * 大小树：最大的块在最右，不需要子树最大值。插入和删除都不递归、不旋转：
+ * 插入时自顶向下找到路径上第一个优先级低于bp的结点，把以它为根的子树按bp拆成两半，
+ * 作bp的左右子树；删除时由父结点直接找到bp所在的位置，把它的左右子树沿相对的两条边合并后接上。
+ * 优先级仍用偏移的散列而不存在块中：比较时不用读结点本身
+ */
+static void tree_insert(int *slot, char *bp){
+    unsigned int prio = TREE_PRIO(bp);
+    int *l = TREE_LEFT(bp), *r = TREE_RIGHT(bp);
+    char *t, *up = H(stack_root), *lup = bp, *rup = bp;
+    while((t=TREE_NODE(slot))!=H(stack_root) && TREE_PRIO(t) > prio){
+        up = t;
+        slot = TREE_LESS(bp,t) ? TREE_LEFT(t) : TREE_RIGHT(t);
+    }
+    *slot = bp - H(stack_root);
+    *TREE_UP(bp) = up - H(stack_root);
+    while(t!=H(stack_root)){
+        if(TREE_LESS(t,bp)){
+            *l = t - H(stack_root);
+            *TREE_UP(t) = lup - H(stack_root);
+            lup = t;
+            l = TREE_RIGHT(t);
+            t = TREE_NODE(l);
+        }
+        else{
+            *r = t - H(stack_root);
+            *TREE_UP(t) = rup - H(stack_root);
+            rup = t;
+            r = TREE_LEFT(t);
+            t = TREE_NODE(r);
+        }
+    }
+    *l = 0;
+    *r = 0;
+}
+static void tree_delete(int *slot, char *bp){
+    char *up = TREE_NODE(TREE_UP(bp)), *l, *r, *t;
+    if(up!=H(stack_root))
+        slot = TREE_NODE(TREE_LEFT(up))==bp ? TREE_LEFT(up) : TREE_RIGHT(up);
+    l = TREE_NODE(TREE_LEFT(bp));
+    r = TREE_NODE(TREE_RIGHT(bp));
+    while(l!=H(stack_root) && r!=H(stack_root)){
+        if(TREE_PRIO(l) > TREE_PRIO(r)){
+            *slot = l - H(stack_root);
+            *TREE_UP(l) = up - H(stack_root);
+            up = l;
+            slot = TREE_RIGHT(l);
+            l = TREE_NODE(slot);
+        }
+        else{
+            *slot = r - H(stack_root);
+            *TREE_UP(r) = up - H(stack_root);
+            up = r;
+            slot = TREE_LEFT(r);
+            r = TREE_NODE(slot);
+        }
+    }
+    t = l!=H(stack_root) ? l : r;
+    *slot = t - H(stack_root);
+    if(t!=H(stack_root))
+        *TREE_UP(t) = up - H(stack_root);
+}
+
+/*
+ * 地址树：按地址排序，第三个字维护子树最大值，供tree_first_fit跳过放不下的子树。
+ * 递归插入、删除，回溯时沿路重算
+ */
+static size_t tree_max(char *t){
+    size_t size;
+    if(t==H(stack_root))
+        return 0;
+    size = GET_SIZE(HDRP(t));
+    return size <= 2*DSIZE ? size : TREE_MAX(t);
+}
+static void tree_fix(char *t){
+    size_t size = GET_SIZE(HDRP(t));
+    size_t l = tree_max(TREE_NODE(TREE_LEFT(t)));
+    size_t r = tree_max(TREE_NODE(TREE_RIGHT(t)));
+    if(size > 2*DSIZE)
+        TREE_MAX(t) = MAX(size, MAX(l, r));
+}
+/*treap的旋转：把slot所指结点的左（右）孩子转上来*/
+static void tree_rotate_right(int *slot){
+    char *t = TREE_NODE(slot);
+    char *l = TREE_NODE(TREE_LEFT(t));
+    *TREE_LEFT(t) = *TREE_RIGHT(l);
+    *TREE_RIGHT(l) = t - H(stack_root);
+    *slot = l - H(stack_root);
+    tree_fix(t);
+    tree_fix(l);
+}
+static void tree_rotate_left(int *slot){
+    char *t = TREE_NODE(slot);
+    char *r = TREE_NODE(TREE_RIGHT(t));
+    *TREE_RIGHT(t) = *TREE_LEFT(r);
+    *TREE_LEFT(r) = t - H(stack_root);
+    *slot = r - H(stack_root);
+    tree_fix(t);
+    tree_fix(r);
+}
+static void addr_insert(int *slot, char *bp){
+    char *t = TREE_NODE(slot);
+    if(t==H(stack_root)){/*作为叶子插入*/
+        *TREE_LEFT(bp) = 0;
+        *TREE_RIGHT(bp) = 0;
+        *slot = bp - H(stack_root);
+        tree_fix(bp);
+    }
+    else if(bp < t){
+        addr_insert(TREE_LEFT(t),bp);
+        tree_fix(t);
+        if(TREE_PRIO(TREE_NODE(TREE_LEFT(t))) > TREE_PRIO(t))
+            tree_rotate_right(slot);
+    }
+    else{
+        addr_insert(TREE_RIGHT(t),bp);
+        tree_fix(t);
+        if(TREE_PRIO(TREE_NODE(TREE_RIGHT(t))) > TREE_PRIO(t))
+            tree_rotate_left(slot);
+    }
+}
+static void addr_delete(int *slot, char *bp){
+    char *t = TREE_NODE(slot), *l, *r;
+    if(t!=bp){/*删除后沿路重算子树最大值*/
+        addr_delete(bp < t ? TREE_LEFT(t) : TREE_RIGHT(t), bp);
+        tree_fix(t);
+        return;
+    }
+    l = TREE_NODE(TREE_LEFT(bp));
+    r = TREE_NODE(TREE_RIGHT(bp));
+    if(l==H(stack_root)){
+        *slot = *TREE_RIGHT(bp);
+        return;
+    }
+    if(r==H(stack_root)){
+        *slot = *TREE_LEFT(bp);
+        return;
+    }
+    /*把优先级较高的孩子转上来，直到bp最多只有一个孩子*/
+    if(TREE_PRIO(l) > TREE_PRIO(r)){
+        tree_rotate_right(slot);
+        addr_delete(TREE_RIGHT(l), bp);
+        tree_fix(l);
+    }
+    else{
+        tree_rotate_left(slot);
+        addr_delete(TREE_LEFT(r), bp);
+        tree_fix(r);
+    }
+}
+/*
+ * tree_first_fit - 左子树中有放得下的块就往左，否则看结点自身，再往右：O(树高)
+ */
+static char *tree_first_fit(char *t, size_t asize, unsigned int *n){
+    while(t!=H(stack_root)){
+        char *l = TREE_NODE(TREE_LEFT(t));
+        (*n)++;
+        if(tree_max(l) >= asize)
+            t = l;
+        else if(asize <= GET_SIZE(HDRP(t)))
+            return t;
+        else if(tree_max(TREE_NODE(TREE_RIGHT(t))) >= asize)
+            t = TREE_NODE(TREE_RIGHT(t));
+        else
+            return NULL;
+    }
+    return NULL;
+}
 static void print_heap(){
     printf("***\n");
-    for(char* i=heap_listp;GET_SIZE(HDRP(i))>0;i=NEXT_BLKP(i)){
+    for(char* i=H(heap_listp);GET_SIZE(HDRP(i))>0;i=NEXT_BLKP(i)){
         unsigned int alloc = GET_ALLOC(HDRP(i));
         unsigned int size = GET_SIZE(HDRP(i));
         unsigned int prev_alloc = GET_PREV_FREE(i)==0;
@@ -426,10 +2815,14 @@ static void print_heap(){
         printf("%p %u %u %u %p %p\n",i,alloc,size,prev_alloc,prev_blk,next_blk);
     }
     printf("&&&\n");
-    for(unsigned int i=0;i<stack_size;i++){
+    for(unsigned int i=0;i<S(stack_size);i++){
         printf("%u:",i);
+        if(S(bin_policy)[i]>=POL_ADDR){
+            printf("tree of %zu blocks\n",S(stats).bin_blocks[i]);
+            continue;
+        }
         char* bp = GET_TOP(i);
-        for (; bp!=stack_root; bp = GET_PREV(bp)) {
+        for (; bp!=H(stack_root); bp = GET_PREV(bp)) {
             unsigned int alloc = GET_ALLOC(HDRP(bp));
             unsigned int size = GET_SIZE(HDRP(bp));
             unsigned int prev_alloc = GET_PREV_FREE(bp)==0;
@@ -440,13 +2833,13 @@ static void print_heap(){
     }
 }
 static unsigned int get_index(unsigned int asize){
-    unsigned int max_size=(1<<STACK_MIN);
+    unsigned int max_size=(1<<S(stack_min));
     if(asize<=max_size)return asize/8 - 1;
-    for(int i=0;i<STACK_MAX;i++){
+    for(unsigned int i=0;i<S(stack_max);i++){
         max_size<<=1;
         if(asize<=max_size){
-            return i+STACK_MIN-1;
+            return i+S(stack_base);
         }
     }
-    return STACK_MAX+STACK_MIN-2;
+    return S(stack_base)+S(stack_max)-1;
 }
\ No newline at end of file
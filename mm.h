@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdint.h>
 
 #ifdef DRIVER
 
@@ -15,10 +16,249 @@ extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern void *memalign(size_t alignment, size_t size);
+extern int posix_memalign(void **memptr, size_t alignment, size_t size);
+extern void *aligned_alloc(size_t alignment, size_t size);
+extern void *valloc(size_t size);
+extern void *pvalloc(size_t size);
+extern size_t malloc_usable_size(void *ptr);
 
 #endif
 
 extern int mm_init(void);
 
+/*
+ * Allocation with hints. MM_HINT_LONG blocks are expected to outlive most
+ * others; they are split from the high end of a free block while other
+ * blocks are split from the low end, so long-lived blocks collect apart
+ * from short-lived ones instead of pinning them and keeping them from
+ * coalescing. MM_HINT_SHORT is the ordinary placement. MM_HINT_ZERO
+ * returns zeroed memory. Free such blocks with free (mm_free).
+ */
+#define MM_HINT_LONG  0x1
+#define MM_HINT_SHORT 0x2
+#define MM_HINT_ZERO  0x4
+extern void *mm_malloc_hint(size_t size, int flags);
+
+/*
+ * Relocatable allocation through handles. mm_halloc returns a handle
+ * (0 on failure) rather than a pointer; mm_hlock pins the block and
+ * returns its payload, valid until the matching mm_hunlock (locks nest).
+ * Unpinned handle blocks may be moved by mm_compact, which slides them
+ * down over the free blocks below them so that free space collects at
+ * the heap end, for up to budget_ns nanoseconds (0 for no limit). It
+ * returns 1 if it stopped early and the next call carries on from
+ * there, 0 once it has reached the heap end. mm_trim gives back to the
+ * system all but pad bytes of a free block at the heap end, returning
+ * 1 if it released any memory.
+ */
+typedef uint32_t mm_handle_t;
+extern mm_handle_t mm_halloc(size_t size);
+extern void mm_hfree(mm_handle_t h);
+extern void *mm_hlock(mm_handle_t h);
+extern void mm_hunlock(mm_handle_t h);
+extern int mm_compact(long budget_ns);
+extern int mm_trim(size_t pad);
+
+/*
+ * Persistent heap. mm_persist_open makes the file at path the heap,
+ * mapped shared at any address, before anything has been allocated
+ * (otherwise it fails with EBUSY). An empty file gets a new heap and
+ * returns 0; a file saved by mm_persist_sync or mm_persist_close is
+ * used as it was left, free lists included, and returns 1. Everything
+ * inside the heap is kept as offsets, so the application's own data
+ * must link its blocks by offset too, and reach them from the root
+ * block set with mm_persist_setroot. A file changed after its last
+ * sync (say, by a crash) is not safe to reopen. Handles do not carry
+ * over: their blocks stay allocated but are no longer moved. Return -1
+ * on error.
+ */
+extern int mm_persist_open(const char *path);
+extern int mm_persist_sync(void);
+extern int mm_persist_close(void);
+extern void mm_persist_setroot(void *p);
+extern void *mm_persist_root(void);
+
+/*
+ * Shared heap. mm_shared_create makes a new heap in a memfd and returns
+ * the descriptor; children forked afterwards share the heap, and other
+ * processes map it with mm_shared_attach(fd) (both before allocating
+ * anything, or they fail with EBUSY). Every call then also takes a
+ * process-shared lock kept in the heap, so a block one process allocates
+ * may be read and freed by another. Pass blocks between processes as
+ * mm_heap_offset values and turn them back with mm_heap_pointer; the
+ * root (mm_persist_setroot) is shared too. mm_persist_close detaches.
+ */
+extern int mm_shared_create(void);
+extern int mm_shared_attach(int fd);
+extern long mm_heap_offset(const void *p);
+extern void *mm_heap_pointer(long off);
+
+/* A snapshot of the heap's shape, for long-running (soak) tests */
+struct mm_heapinfo {
+    size_t heap_size;     /* bytes obtained from mem_sbrk */
+    size_t free_bytes;    /* bytes in free blocks */
+    size_t free_blocks;   /* number of free blocks */
+    size_t largest_free;  /* size of the largest free block */
+    size_t longest_chain; /* most free blocks in one size class */
+};
+extern void mm_heapinfo(struct mm_heapinfo *info);
+
+/*
+ * Live statistics, maintained as the heap changes so that mm_stats()
+ * is cheap enough to poll (it does not walk the heap)
+ */
+#define MM_MAX_BINS 32
+struct mm_stats {
+    size_t heap_size;          /* bytes obtained from mem_sbrk */
+    size_t alloc_bytes;        /* bytes in allocated blocks, headers included */
+    size_t alloc_blocks;       /* number of allocated blocks */
+    size_t free_bytes;         /* bytes in free blocks */
+    size_t free_blocks;        /* number of free blocks */
+    size_t fast_bytes;         /* of those, bytes in fast bins (not coalesced) */
+    size_t fast_blocks;        /* of those, blocks in fast bins */
+    size_t largest_free;       /* size of the largest free block */
+    unsigned int nbins;        /* size classes in use (<= MM_MAX_BINS) */
+    size_t bin_bytes[MM_MAX_BINS];  /* free bytes in each size class */
+    size_t bin_blocks[MM_MAX_BINS]; /* free blocks in each size class */
+    unsigned long extends;     /* times the heap was extended */
+    unsigned long splits;      /* free blocks split by an allocation */
+    unsigned long coalesces;   /* free blocks merged with a neighbour */
+    unsigned long moves;       /* handle blocks moved by mm_compact */
+    size_t moved_bytes;        /* bytes in the blocks moved */
+    size_t trimmed_bytes;      /* bytes given back by mm_trim */
+};
+extern void mm_stats(struct mm_stats *st);
+
+/*
+ * Separate heaps. mm_heap_create makes a heap of up to max bytes (0 for
+ * the size of the default heap) in a mapping of its own, apart from the
+ * heap malloc uses, with the parameters set at the time. Its blocks are
+ * freed and resized only through the mm_heap_* calls for the same heap.
+ * Each heap has its own lock, so threads using different heaps do not
+ * contend. mm_heap_destroy gives the whole heap back at once, blocks
+ * still allocated included. mm_heap_create returns NULL on failure.
+ */
+typedef struct mm_heap mm_heap_t;
+extern mm_heap_t *mm_heap_create(size_t max);
+extern void mm_heap_destroy(mm_heap_t *h);
+extern void *mm_heap_malloc(mm_heap_t *h, size_t size);
+extern void mm_heap_free(mm_heap_t *h, void *ptr);
+extern void *mm_heap_realloc(mm_heap_t *h, void *ptr, size_t size);
+extern void mm_heap_stats(mm_heap_t *h, struct mm_stats *st);
+
+/*
+ * Regions (arenas), for objects that all die together, such as those of
+ * one request. mm_region_alloc bumps a pointer through a chunk taken
+ * from the heap with malloc, chunk bytes at a time (0 for 16KB), and
+ * takes another chunk when that one is used up; requests over a quarter
+ * of a chunk get a chunk of their own. Objects are not freed one by one:
+ * mm_region_reset gives every chunk back to the heap at once, and
+ * mm_region_destroy the region as well. A region is not locked, so only
+ * one thread may use it at a time. mm_region_chunks counts the chunks
+ * taken so far. mm_region_create and mm_region_alloc return NULL on
+ * failure.
+ */
+typedef struct mm_region mm_region_t;
+extern mm_region_t *mm_region_create(size_t chunk);
+extern void *mm_region_alloc(mm_region_t *r, size_t size);
+extern void mm_region_reset(mm_region_t *r);
+extern void mm_region_destroy(mm_region_t *r);
+extern size_t mm_region_chunks(mm_region_t *r);
+
+/*
+ * Hot-path counters, compiled in with -DMM_COUNTERS (make COUNTERS=1)
+ * and reset by mm_init. mm_counters returns -1 (errno ENOSYS) when they
+ * are not compiled in.
+ */
+struct mm_counters {
+    unsigned long fit_calls;     /* calls to find_fit */
+    unsigned long fit_nodes;     /* free-list nodes visited */
+    unsigned long fit_bins;      /* size classes probed, empty ones included */
+    unsigned long fit_max_nodes; /* most nodes visited by a single call */
+    unsigned long fit_misses;    /* calls that found no fit */
+    unsigned long coalesce[4];   /* coalesce cases 1-4 (neither, next, prev, both free) */
+    unsigned long splits;        /* place() split the free block */
+    unsigned long unsplit;       /* place() used the whole free block... */
+    unsigned long exact;         /* ...of exactly the requested size */
+    unsigned long extends;       /* calls to extend_heap */
+    unsigned long fast_frees;    /* frees put in a fast bin */
+    unsigned long fast_hits;     /* mallocs served from a fast bin */
+    unsigned long consolidates;  /* times the fast bins were coalesced */
+    unsigned long dv_hits;       /* mallocs split from the designated victim */
+};
+extern int mm_counters(struct mm_counters *c);
+
+/*
+ * Tunable parameters, applied at the next mm_init:
+ *   stack_min  sizes up to 1<<stack_min get one size class per 8 bytes
+ *   stack_max  number of power-of-two size classes above that
+ *   chunksize  minimum bytes to extend the heap by
+ *   split_min  smallest remainder worth splitting off a free block
+ *   rt         1 for real-time mode: good fit from the first nonempty
+ *              size class that is sure to fit, found with a bitmap, so
+ *              malloc and free take constant time (no list walks), at
+ *              some cost in utilization; tree_min and policy are
+ *              ignored, every class being a LIFO stack
+ *   tree_min   free blocks in power-of-two classes from this size up are
+ *              kept in trees ordered by (size, address) and allocated
+ *              best fit; 0 keeps every class a LIFO stack (first fit)
+ *   policy     how the other classes keep their free blocks: 0 LIFO,
+ *              1 FIFO, 2 address-ordered (a tree, searched first fit in
+ *              address order); "policy.<i>" sets class i only
+ *   fast_max   blocks up to this size are freed into per-size fast bins
+ *              without coalescing and reused by requests of the same
+ *              size; the bins are coalesced when a request finds no fit
+ *              or they hold more than 1KB. 0 (the default) turns them
+ *              off; they are always off in rt mode
+ *   dv_max     when a request up to this size splits a free block, the
+ *              remainder is kept out of the size classes as the
+ *              "designated victim", and later requests up to this size
+ *              are split from it first (unless their own size class
+ *              has free blocks), so they get adjacent addresses.
+ *              Default 1024; 0 turns it off
+ *   reserve    bytes to extend the heap by in mm_init, so that growing
+ *              it (a system call) is put off until they are used up
+ * mm_setparam returns -1 (errno EINVAL) for an unknown name or a value
+ * out of range; mm_getparam returns -1 for an unknown name.
+ */
+extern int mm_setparam(const char *name, long value);
+extern long mm_getparam(const char *name);
+
+/*
+ * Heap profiling: with the sample_rate parameter set, about one block
+ * per sample_rate bytes allocated is sampled with its call stack, and
+ * dropped when freed. mm_heapprof_dump writes the live samples, grouped
+ * by stack, to fd in pprof's heap_v2 text format. Returns 0 or -1.
+ */
+extern int mm_heapprof_dump(int fd);
+
+/*
+ * Event tracing, compiled in with -DMM_EVENTS (libmm.so is built that
+ * way). Once enabled, every call appends one fixed-size record to a
+ * per-thread ring buffer; a full ring drops new events rather than
+ * block. A single reader at a time takes them out with mm_events_drain,
+ * or with mm_events_dump, which only uses write() and so may be called
+ * from a signal handler. Under libmm.so, MM_EVENTS_FILE=<file> enables
+ * tracing and dumps to that file on SIGUSR2 and at exit. Without
+ * MM_EVENTS, mm_events_enable fails with ENOSYS.
+ */
+enum { MM_EV_MALLOC = 1, MM_EV_FREE, MM_EV_REALLOC, MM_EV_CALLOC,
+       MM_EV_MEMALIGN, MM_EV_EXTEND };
+struct mm_event {
+    uint64_t tsc;     /* timestamp counter when the call returned */
+    uint64_t addr;    /* block returned, freed, or added by extend */
+    uint32_t size;    /* bytes requested; block size for free and extend */
+    uint32_t cycles;  /* duration of the call, lock wait included */
+    uint32_t tid;     /* calling thread */
+    uint16_t search;  /* free blocks examined by the fit search */
+    uint8_t op;       /* MM_EV_* */
+    uint8_t bin;      /* size class of the block, 255 if none fit */
+};
+extern int mm_events_enable(int on);
+extern size_t mm_events_drain(struct mm_event *buf, size_t max);
+extern long mm_events_dump(int fd);
+extern unsigned long mm_events_dropped(void);
+
 /* This is largely for debugging. */
 extern void mm_checkheap(int lineno);
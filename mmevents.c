@@ -0,0 +1,143 @@
+/*
+ * mmevents.c - Print the allocator event records written by libmm.so.
+ *
+ * With libmm.so built with -DMM_EVENTS (the default in the Makefile),
+ * MM_EVENTS_FILE names a file that receives the binary event records
+ * (struct mm_event in mm.h) on SIGUSR2 and at exit:
+ *
+ *     unix> LD_PRELOAD=./libmm.so MM_EVENTS_FILE=ls.ev ls -l
+ *     unix> ./mmevents ls.ev          # one line per event
+ *     unix> ./mmevents -s ls.ev       # summary per operation
+ *
+ * Events from different threads are interleaved by ring, not by time;
+ * sort on the tsc column to put them in order.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+
+#define NOPS (MM_EV_EXTEND + 1)
+#define NBINS 256
+
+static const char *op_names[NOPS] = {
+    "?", "malloc", "free", "realloc", "calloc", "memalign", "extend"
+};
+
+struct op_sum {
+    unsigned long count;
+    unsigned long failed;     /* calls that returned NULL */
+    double bytes;
+    double cycles;
+    double search;
+    uint32_t max_cycles;
+    uint16_t max_search;
+};
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mmevents [-hs] <file>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-s         Print a summary per operation and size class.\n");
+}
+
+static void print_event(const struct mm_event *e)
+{
+    const char *name = e->op < NOPS ? op_names[e->op] : "?";
+    printf("%llu %u %-8s %10u 0x%llx", (unsigned long long)e->tsc, e->tid,
+           name, e->size, (unsigned long long)e->addr);
+    if (e->bin != 255)
+        printf(" bin=%u", e->bin);
+    if (e->search)
+        printf(" search=%u", e->search);
+    if (e->cycles)
+        printf(" cycles=%u", e->cycles);
+    printf("\n");
+}
+
+static void print_summary(struct op_sum *ops, unsigned long *bins)
+{
+    int i;
+
+    printf("%-8s %10s %8s %10s %10s %10s %8s %8s\n", "op", "count", "failed",
+           "avg size", "avg cyc", "max cyc", "avg srch", "max srch");
+    for (i = 1; i < NOPS; i++) {
+        struct op_sum *s = &ops[i];
+        if (s->count == 0)
+            continue;
+        printf("%-8s %10lu %8lu %10.0f %10.0f %10u %8.1f %8u\n", op_names[i],
+               s->count, s->failed, s->bytes / s->count, s->cycles / s->count,
+               s->max_cycles, s->search / s->count, s->max_search);
+    }
+    printf("\n%-8s %10s\n", "class", "allocs");
+    for (i = 0; i < NBINS - 1; i++)
+        if (bins[i])
+            printf("%-8d %10lu\n", i, bins[i]);
+    if (bins[NBINS - 1])
+        printf("%-8s %10lu\n", "no fit", bins[NBINS - 1]);
+}
+
+int main(int argc, char **argv)
+{
+    struct op_sum ops[NOPS];
+    unsigned long bins[NBINS];
+    struct mm_event e;
+    int summary = 0;
+    char c;
+    FILE *fp;
+
+    while ((c = getopt(argc, argv, "hs")) != EOF) {
+        switch (c) {
+        case 's':
+            summary = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        exit(1);
+    }
+    if ((fp = fopen(argv[optind], "rb")) == NULL) {
+        perror(argv[optind]);
+        exit(1);
+    }
+
+    memset(ops, 0, sizeof(ops));
+    memset(bins, 0, sizeof(bins));
+    while (fread(&e, sizeof(e), 1, fp) == 1) {
+        struct op_sum *s;
+        if (!summary) {
+            print_event(&e);
+            continue;
+        }
+        s = &ops[e.op < NOPS ? e.op : 0];
+        s->count++;
+        s->bytes += e.size;
+        s->cycles += e.cycles;
+        s->search += e.search;
+        if (e.cycles > s->max_cycles)
+            s->max_cycles = e.cycles;
+        if (e.search > s->max_search)
+            s->max_search = e.search;
+        if (e.op != MM_EV_FREE && e.op != MM_EV_EXTEND) {
+            if (e.addr == 0)
+                s->failed++;
+            else
+                bins[e.bin]++;
+        }
+    }
+    fclose(fp);
+    if (summary)
+        print_summary(ops, bins);
+    return 0;
+}
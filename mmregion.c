@@ -0,0 +1,189 @@
+/*
+ * mmregion.c - Benchmark of regions (mm_region_create in mm.h) against
+ *     per-object malloc/free on a request-scoped workload.
+ *
+ * Each simulated request allocates a number of objects of mixed sizes
+ * (mostly small, some up to a few KB), writes every byte of them, and
+ * drops them all when it ends, in one of two ways:
+ *
+ *   malloc  each object is an mm_malloc block, freed by mm_free in the
+ *           order allocated when the request ends
+ *   region  each object is bumped out of a region, and mm_region_reset
+ *           hands the region's chunks back to the heap in one go
+ *
+ * In both, every request also replaces one long-lived object in a ring
+ * of RING blocks with mm_malloc/mm_free, so that the heap is not empty
+ * between requests. Both modes see the same sizes, and each starts
+ * from an empty heap.
+ *
+ *     unix> ./mmregion                # default workload
+ *     unix> ./mmregion -n 5000 -o 1000 -c 65536
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define NREQS 20000         /* default requests */
+#define NOBJS 256           /* default objects per request */
+#define RING 1024           /* long-lived objects */
+
+enum { MALLOC, REGION };
+
+struct result {
+    double secs;            /* elapsed time */
+    size_t heap_size;       /* heap size at the end */
+    size_t chunks;          /* chunks taken by the region */
+};
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mmregion [-h] [-n <reqs>] [-o <objs>] [-c <bytes>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <reqs>  Run <reqs> requests (default %d).\n", NREQS);
+    fprintf(stderr, "\t-o <objs>  Allocate <objs> objects per request (default %d).\n", NOBJS);
+    fprintf(stderr, "\t-c <bytes> Take region chunks of <bytes> (default 16KB).\n");
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* xorshift, so that both modes draw the same sizes */
+static unsigned long rnd(unsigned long *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+/* 3/4 of objects 16-128 bytes, most of the rest up to 1KB, 1/32 up to 8KB */
+static size_t object_size(unsigned long *x)
+{
+    unsigned long r = rnd(x);
+    switch (r & 31) {
+    case 0:
+        return 1024 + (r >> 8) % 7169;
+    case 1: case 2: case 3: case 4: case 5: case 6: case 7:
+        return 128 + (r >> 8) % 897;
+    default:
+        return 16 + (r >> 8) % 113;
+    }
+}
+
+static struct result run(int mode, long nreqs, long nobjs, size_t chunk)
+{
+    void **objs = malloc(nobjs * sizeof(*objs));
+    void *ring[RING];
+    unsigned long x = 88172645463325252UL;
+    struct result res;
+    struct mm_stats st;
+    mm_region_t *r = NULL;
+    double start;
+    long i, j;
+
+    if (objs == NULL) {
+        fprintf(stderr, "mmregion: out of memory\n");
+        exit(1);
+    }
+    mem_reset_brk();
+    mm_init();
+    memset(ring, 0, sizeof(ring));
+    if (mode == REGION && (r = mm_region_create(chunk)) == NULL) {
+        fprintf(stderr, "mmregion: mm_region_create failed\n");
+        exit(1);
+    }
+
+    start = now();
+    for (i = 0; i < nreqs; i++) {
+        size_t size;
+        for (j = 0; j < nobjs; j++) {
+            size = object_size(&x);
+            objs[j] = mode == REGION ? mm_region_alloc(r, size) : mm_malloc(size);
+            if (objs[j] == NULL) {
+                fprintf(stderr, "mmregion: allocation failed\n");
+                exit(1);
+            }
+            memset(objs[j], (int)j, size);
+        }
+        size = 64 + rnd(&x) % 449;
+        mm_free(ring[i % RING]);
+        if ((ring[i % RING] = mm_malloc(size)) == NULL) {
+            fprintf(stderr, "mmregion: allocation failed\n");
+            exit(1);
+        }
+        memset(ring[i % RING], (int)i, size);
+        if (mode == REGION)
+            mm_region_reset(r);
+        else
+            for (j = 0; j < nobjs; j++)
+                mm_free(objs[j]);
+    }
+    res.secs = now() - start;
+
+    res.chunks = r ? mm_region_chunks(r) : 0;
+    mm_region_destroy(r);
+    for (i = 0; i < RING; i++)
+        mm_free(ring[i]);
+    mm_stats(&st);
+    res.heap_size = st.heap_size;
+    free(objs);
+    return res;
+}
+
+int main(int argc, char **argv)
+{
+    long nreqs = NREQS, nobjs = NOBJS;
+    size_t chunk = 0;
+    struct result m, g;
+    double nops;
+    int c;
+
+    while ((c = getopt(argc, argv, "hn:o:c:")) != EOF) {
+        switch (c) {
+        case 'n':
+            nreqs = atol(optarg);
+            break;
+        case 'o':
+            nobjs = atol(optarg);
+            break;
+        case 'c':
+            chunk = atol(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (nreqs <= 0 || nobjs <= 0) {
+        usage();
+        exit(1);
+    }
+
+    mem_init();
+    m = run(MALLOC, nreqs, nobjs, chunk);
+    g = run(REGION, nreqs, nobjs, chunk);
+    nops = (double)nreqs * nobjs;
+
+    printf("%ld requests of %ld objects\n", nreqs, nobjs);
+    printf("%-8s %10s %10s %12s %10s\n", "mode", "secs", "ns/obj", "heap KB", "chunks");
+    printf("%-8s %10.3f %10.1f %12zu %10s\n", "malloc", m.secs,
+           m.secs / nops * 1e9, m.heap_size / 1024, "-");
+    printf("%-8s %10.3f %10.1f %12zu %10zu\n", "region", g.secs,
+           g.secs / nops * 1e9, g.heap_size / 1024, g.chunks);
+    printf("speedup %.2fx\n", m.secs / g.secs);
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * mmshare.c - Two-process producer/consumer benchmark for the shared
+ *     heap (mm_shared_create in mm.h).
+ *
+ * For each object size, a producer process hands a stream of objects
+ * to a consumer process, which checksums each one, in two ways:
+ *
+ *   copy    the producer writes the bytes of each object into a pipe
+ *           and the consumer reads them into its own buffer
+ *   shared  the producer allocates the object in the shared heap and
+ *           writes only its offset into the pipe; the consumer reads
+ *           the object in place and frees it
+ *
+ * Both fill and checksum every byte, so the difference is the cost of
+ * the copies through the kernel against that of the shared allocator.
+ * The consumer reports its progress on a second pipe a quarter of a
+ * window at a time, so that the producer keeps at most WINDOW bytes of
+ * objects in flight.
+ *
+ *     unix> ./mmshare                 # the default sizes
+ *     unix> ./mmshare -m 64 4096      # 64 MB of 4 KB objects
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define MBYTES 256          /* default bytes streamed per size, in MB */
+#define WINDOW (8 << 20)    /* most bytes in flight */
+#define MAXSIZE (16 << 20)  /* largest object */
+
+static const long default_sizes[] = { 64, 1024, 16384, 262144, 1048576 };
+
+enum { COPY, SHARED };
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: mmshare [-h] [-m <MB>] [size...]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-m <MB>    Stream <MB> megabytes per size (default %d).\n", MBYTES);
+}
+
+static void unix_error(const char *msg)
+{
+    fprintf(stderr, "mmshare: %s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void read_full(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r <= 0)
+            unix_error("read");
+        p += r;
+        n -= r;
+    }
+}
+
+static void write_full(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    while (n > 0) {
+        ssize_t r = write(fd, p, n);
+        if (r <= 0)
+            unix_error("write");
+        p += r;
+        n -= r;
+    }
+}
+
+static void fill(char *p, long size, long seq)
+{
+    long i;
+    for (i = 0; i < size; i += sizeof(long))
+        *(long *)(p + i) = seq + i;
+}
+
+static unsigned long checksum(const char *p, long size)
+{
+    unsigned long sum = 0;
+    long i;
+    for (i = 0; i < size; i += sizeof(long))
+        sum += *(const unsigned long *)(p + i);
+    return sum;
+}
+
+/*
+ * consume - the consumer's side: take n objects off the data pipe and
+ *     acknowledge every batch of them on the ack pipe. Returns the sum
+ *     of the checksums.
+ */
+static unsigned long consume(int mode, int data, int ack, long size, long n,
+                             long batch)
+{
+    char *buf = mode == COPY ? malloc(size) : NULL;
+    unsigned long sum = 0;
+    long i, off;
+
+    if (mode == COPY && buf == NULL)
+        unix_error("malloc");
+    for (i = 1; i <= n; i++) {
+        if (mode == COPY) {
+            read_full(data, buf, size);
+            sum += checksum(buf, size);
+        } else {
+            read_full(data, &off, sizeof(off));
+            sum += checksum(mm_heap_pointer(off), size);
+            mm_free(mm_heap_pointer(off));
+        }
+        if (i % batch == 0 || i == n)
+            write_full(ack, &i, sizeof(i));
+    }
+    free(buf);
+    return sum;
+}
+
+/*
+ * run - stream n objects of the given size from this process to a
+ *     forked consumer. Returns the elapsed seconds.
+ */
+static double run(int mode, long size, long n)
+{
+    int data[2], ack[2], status;
+    long window = WINDOW / size > 0 ? WINDOW / size : 1;
+    long batch = window / 4 > 0 ? window / 4 : 1;
+    unsigned long words = size / sizeof(long), sum = 0, csum;
+    long i, done = 0;
+    char *buf = NULL;
+    double start;
+    pid_t pid;
+
+    if (pipe(data) < 0 || pipe(ack) < 0)
+        unix_error("pipe");
+    start = now();
+    if ((pid = fork()) < 0)
+        unix_error("fork");
+    if (pid == 0) {
+        close(data[1]);
+        close(ack[0]);
+        csum = consume(mode, data[0], ack[1], size, n, batch);
+        write_full(ack[1], &csum, sizeof(csum));
+        _exit(0);
+    }
+    close(data[0]);
+    close(ack[1]);
+
+    if (mode == COPY && (buf = malloc(size)) == NULL)
+        unix_error("malloc");
+    for (i = 0; i < n; i++) {
+        while (i - done >= window)
+            read_full(ack[0], &done, sizeof(done));
+        if (mode == COPY) {
+            fill(buf, size, i);
+            write_full(data[1], buf, size);
+        } else {
+            char *p = mm_malloc(size);
+            long off;
+            if (p == NULL)
+                unix_error("mm_malloc");
+            off = mm_heap_offset(p);
+            fill(p, size, i);
+            write_full(data[1], &off, sizeof(off));
+        }
+    }
+    while (done < n)
+        read_full(ack[0], &done, sizeof(done));
+    read_full(ack[0], &csum, sizeof(csum));
+    if (waitpid(pid, &status, 0) < 0)
+        unix_error("waitpid");
+    close(data[1]);
+    close(ack[0]);
+    free(buf);
+
+    /* the consumer must have seen every word the producer wrote */
+    for (i = 0; i < n; i++)
+        sum += words * i + sizeof(long) * words * (words - 1) / 2;
+    if (sum != csum) {
+        fprintf(stderr, "mmshare: %s checksum mismatch at size %ld\n",
+                mode == COPY ? "copy" : "shared", size);
+        exit(1);
+    }
+    return now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    long mbytes = MBYTES, sizes[64];
+    int nsizes = 0, i, c, fd;
+
+    while ((c = getopt(argc, argv, "hm:")) != EOF) {
+        switch (c) {
+        case 'm':
+            mbytes = atol(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    for (; optind < argc && nsizes < 64; optind++) {
+        long size = atol(argv[optind]);
+        if (size < (long)sizeof(long) || size > MAXSIZE) {
+            fprintf(stderr, "mmshare: size %s out of range\n", argv[optind]);
+            exit(1);
+        }
+        sizes[nsizes++] = size & ~(long)(sizeof(long) - 1);
+    }
+    if (nsizes == 0) {
+        nsizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+        memcpy(sizes, default_sizes, sizeof(default_sizes));
+    }
+
+    if ((fd = mm_shared_create()) < 0)
+        unix_error("mm_shared_create");
+
+    printf("%10s %10s %12s %12s %12s %12s %8s\n", "size", "objects",
+           "copy MB/s", "shared MB/s", "copy Kobj/s", "shared Kobj/s", "speedup");
+    for (i = 0; i < nsizes; i++) {
+        long size = sizes[i];
+        long n = (mbytes << 20) / size > 0 ? (mbytes << 20) / size : 1;
+        double copy = run(COPY, size, n);
+        double shm = run(SHARED, size, n);
+        printf("%10ld %10ld %12.0f %12.0f %12.1f %12.1f %7.2fx\n", size, n,
+               n * size / copy / 1048576, n * size / shm / 1048576,
+               n / copy / 1e3, n / shm / 1e3, copy / shm);
+    }
+
+    mm_persist_close();
+    close(fd);
+    return 0;
+}
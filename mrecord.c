@@ -0,0 +1,572 @@
+/*
+ * mrecord.c - LD_PRELOAD allocation recorder.
+ *
+ * Interposes malloc, free, realloc, calloc and the memalign family,
+ * gives every live pointer a trace id, and writes the resulting request
+ * stream as a .rep file that mdriver can replay directly:
+ *
+ *     unix> LD_PRELOAD=./librecord.so MRECORD_FILE=ls.rep ls -l
+ *     unix> ./mdriver -f ls.rep
+ *
+ * Each thread appends fixed-size binary records to its own buffer and
+ * only takes the output lock when the buffer fills, so the cost on the
+ * hot path is one hash update, one atomic increment and a store. Every
+ * record carries a global sequence number; at exit the records are
+ * sorted back into program order and converted to the text format.
+ *
+ * Environment:
+ *     MRECORD_FILE  output trace (default "mrecord.rep"); a "%p" in the
+ *                   name is replaced by the pid, so that programs which
+ *                   exec others do not overwrite each other's traces
+ *     MRECORD_TID   if set, append "tid=<n>" to each request
+ *     MRECORD_TIME  if set, append "ns=<n>" (since start) to each request
+ *     MRECORD_LIFETIME=<n>
+ *                   mark each allocation "hint=l" (long-lived) if its
+ *                   block outlives more than n requests or is never
+ *                   freed, and "hint=s" (short-lived) otherwise, for
+ *                   mdriver to pass to mm_malloc_hint
+ *
+ * Aligned allocations are recorded as plain allocations of the same
+ * size, since the trace format has no notion of alignment. Pointers
+ * allocated before the recorder started are not recorded; freeing
+ * them is ignored, and reallocating them shows up as a new allocation.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TBUF_RECS     4096      /* records per thread buffer */
+#define NSTRIPES      64        /* lock stripes in the pointer map */
+#define STRIPE_BUCKETS (1<<14)  /* hash buckets per stripe */
+#define NODE_POOL     (1<<12)   /* map nodes obtained per mmap */
+#define BOOT_BYTES    (1<<16)   /* static arena used while resolving libc */
+#define RANGES_LIMIT  20000     /* above this many ids, tell mdriver to
+                                   skip its quadratic overlap check */
+
+/* One recorded request */
+typedef struct {
+    uint64_t seq;   /* global order */
+    uint64_t ns;    /* time since start */
+    uint64_t size;  /* payload size (0 for free) */
+    uint32_t id;    /* trace id of the block */
+    uint32_t tid;   /* recorder thread number */
+    char type;      /* 'a', 'r' or 'f' */
+} rec_t;
+
+/* Per-thread record buffer */
+typedef struct tbuf {
+    struct tbuf *next;  /* list of all buffers, for the final flush */
+    uint32_t tid;
+    int n;
+    rec_t recs[TBUF_RECS];
+} tbuf_t;
+
+/* Pointer-to-id map node */
+typedef struct node {
+    struct node *next;
+    void *ptr;
+    uint32_t id;
+} node_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    node_t *free_nodes;
+    node_t *buckets[STRIPE_BUCKETS];
+} stripe_t;
+
+/* real libc entry points */
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+
+static char boot_arena[BOOT_BYTES] __attribute__((aligned(16)));
+static size_t boot_used;
+
+static int enabled;              /* recording switched on */
+static int with_tid, with_time;
+static long lifetime;             /* MRECORD_LIFETIME, 0 if unset */
+static char out_path[4096];
+static char raw_path[4096 + 8];
+static int raw_fd = -1;
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t tbuf_key;
+static tbuf_t *all_tbufs;
+static uint64_t next_seq;
+static uint32_t next_id;
+static uint32_t next_tid;
+static struct timespec start_ts;
+static stripe_t *stripes;
+
+static __thread tbuf_t *my_tbuf;
+static __thread int in_hook;     /* guards against recording ourselves */
+
+/*
+ * boot_alloc - serve the allocations dlsym() makes before the real
+ *     allocator is known
+ */
+static void *boot_alloc(size_t size)
+{
+    size_t off = (boot_used + 15) & ~(size_t)15;
+    if (off + size > BOOT_BYTES)
+        return NULL;
+    boot_used = off + size;
+    return boot_arena + off;
+}
+
+static int is_boot(const void *p)
+{
+    return (const char *)p >= boot_arena && (const char *)p < boot_arena + BOOT_BYTES;
+}
+
+/*
+ * resolve - look up the libc allocator
+ */
+static void resolve(void)
+{
+    static int resolving = 0;
+    if (real_malloc || resolving)
+        return;
+    resolving = 1;
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    resolving = 0;
+}
+
+/*********************************************
+ * Pointer map: live pointer -> trace id
+ ********************************************/
+
+static inline size_t ptr_hash(const void *p)
+{
+    uint64_t x = (uint64_t)(uintptr_t)p >> 4;
+    x *= 0x9e3779b97f4a7c15ULL;
+    return (size_t)(x >> 20);
+}
+
+static void map_insert(void *p, uint32_t id)
+{
+    size_t h = ptr_hash(p);
+    stripe_t *s = &stripes[h % NSTRIPES];
+    size_t b = (h / NSTRIPES) % STRIPE_BUCKETS;
+    node_t *n;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->free_nodes == NULL) {
+        node_t *pool = mmap(NULL, NODE_POOL * sizeof(node_t), PROT_READ|PROT_WRITE,
+                            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (pool == MAP_FAILED) {
+            pthread_mutex_unlock(&s->lock);
+            return;
+        }
+        for (int i = 0; i < NODE_POOL; i++) {
+            pool[i].next = s->free_nodes;
+            s->free_nodes = &pool[i];
+        }
+    }
+    n = s->free_nodes;
+    s->free_nodes = n->next;
+    n->ptr = p;
+    n->id = id;
+    n->next = s->buckets[b];
+    s->buckets[b] = n;
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* map_remove - drop p from the map; return 1 and its id if it was there */
+static int map_remove(void *p, uint32_t *id)
+{
+    size_t h = ptr_hash(p);
+    stripe_t *s = &stripes[h % NSTRIPES];
+    size_t b = (h / NSTRIPES) % STRIPE_BUCKETS;
+    node_t **pp, *n;
+    int found = 0;
+
+    pthread_mutex_lock(&s->lock);
+    for (pp = &s->buckets[b]; (n = *pp) != NULL; pp = &n->next) {
+        if (n->ptr == p) {
+            *pp = n->next;
+            *id = n->id;
+            n->next = s->free_nodes;
+            s->free_nodes = n;
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return found;
+}
+
+/*********************************************
+ * Record buffers
+ ********************************************/
+
+static void flush_tbuf(tbuf_t *tb)
+{
+    size_t len = tb->n * sizeof(rec_t);
+    const char *p = (const char *)tb->recs;
+
+    pthread_mutex_lock(&out_lock);
+    while (len > 0 && raw_fd >= 0) {
+        ssize_t w = write(raw_fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        p += w;
+        len -= w;
+    }
+    pthread_mutex_unlock(&out_lock);
+    tb->n = 0;
+}
+
+static void tbuf_exit(void *arg)
+{
+    flush_tbuf((tbuf_t *)arg);
+}
+
+static tbuf_t *get_tbuf(void)
+{
+    tbuf_t *tb = my_tbuf;
+    if (tb)
+        return tb;
+    tb = mmap(NULL, sizeof(tbuf_t), PROT_READ|PROT_WRITE,
+              MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (tb == MAP_FAILED)
+        return NULL;
+    tb->n = 0;
+    tb->tid = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&out_lock);
+    tb->next = all_tbufs;
+    all_tbufs = tb;
+    pthread_mutex_unlock(&out_lock);
+    pthread_setspecific(tbuf_key, tb);
+    my_tbuf = tb;
+    return tb;
+}
+
+static void record(char type, uint32_t id, size_t size)
+{
+    tbuf_t *tb = get_tbuf();
+    rec_t *r;
+
+    if (tb == NULL)
+        return;
+    r = &tb->recs[tb->n];
+    r->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    r->type = type;
+    r->id = id;
+    r->size = size;
+    r->tid = tb->tid;
+    r->ns = 0;
+    if (with_time) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        r->ns = (uint64_t)(ts.tv_sec - start_ts.tv_sec) * 1000000000ULL
+            + ts.tv_nsec - start_ts.tv_nsec;
+    }
+    if (++tb->n == TBUF_RECS)
+        flush_tbuf(tb);
+}
+
+/*
+ * note_alloc, note_free, note_realloc - record one request. The caller
+ *     has already checked that recording is on and that we are not
+ *     inside one of our own hooks.
+ */
+static void note_alloc(void *p, size_t size)
+{
+    uint32_t id;
+    if (p == NULL)
+        return;
+    id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    map_insert(p, id);
+    record('a', id, size ? size : 1);
+}
+
+static void note_realloc(void *newp, size_t size, uint32_t id)
+{
+    map_insert(newp, id);
+    record('r', id, size);
+}
+
+/*********************************************
+ * Startup and final conversion
+ ********************************************/
+
+static int cmp_seq(const void *a, const void *b)
+{
+    uint64_t x = ((const rec_t *)a)->seq, y = ((const rec_t *)b)->seq;
+    return (x > y) - (x < y);
+}
+
+static void atfork_child(void)
+{
+    /* the child's requests would interleave with ours; don't record them */
+    enabled = 0;
+    raw_fd = -1;
+}
+
+__attribute__((constructor))
+static void mrecord_init(void)
+{
+    const char *s, *p;
+
+    resolve();
+    in_hook++;
+    if ((s = getenv("MRECORD_FILE")) == NULL || *s == '\0')
+        s = "mrecord.rep";
+    if ((p = strstr(s, "%p")) != NULL)
+        snprintf(out_path, sizeof(out_path), "%.*s%d%s",
+                 (int)(p - s), s, (int)getpid(), p + 2);
+    else
+        snprintf(out_path, sizeof(out_path), "%s", s);
+    snprintf(raw_path, sizeof(raw_path), "%s.raw", out_path);
+    with_tid = getenv("MRECORD_TID") != NULL;
+    with_time = getenv("MRECORD_TIME") != NULL;
+    if ((s = getenv("MRECORD_LIFETIME")) != NULL)
+        lifetime = atol(s);
+    clock_gettime(CLOCK_MONOTONIC, &start_ts);
+
+    stripes = mmap(NULL, NSTRIPES * sizeof(stripe_t), PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    raw_fd = open(raw_path, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (stripes == MAP_FAILED || raw_fd < 0) {
+        fprintf(stderr, "mrecord: cannot record to %s: %s\n", raw_path, strerror(errno));
+        in_hook--;
+        return;
+    }
+    for (int i = 0; i < NSTRIPES; i++)
+        pthread_mutex_init(&stripes[i].lock, NULL);
+    pthread_key_create(&tbuf_key, tbuf_exit);
+    pthread_atfork(NULL, NULL, atfork_child);
+    in_hook--;
+    enabled = 1;
+}
+
+/*
+ * mrecord_fini - flush every thread's buffer, sort the records into
+ *     program order, and write the .rep file
+ */
+__attribute__((destructor))
+static void mrecord_fini(void)
+{
+    struct stat st;
+    rec_t *recs;
+    size_t nrecs;
+    FILE *out;
+
+    if (!enabled)
+        return;
+    enabled = 0;
+    in_hook++;
+
+    for (tbuf_t *tb = all_tbufs; tb != NULL; tb = tb->next)
+        flush_tbuf(tb);
+
+    if (fstat(raw_fd, &st) < 0 || (out = fopen(out_path, "w")) == NULL) {
+        fprintf(stderr, "mrecord: cannot write %s: %s\n", out_path, strerror(errno));
+        in_hook--;
+        return;
+    }
+    nrecs = st.st_size / sizeof(rec_t);
+    recs = nrecs ? mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, raw_fd, 0) : NULL;
+    if (recs == MAP_FAILED) {
+        fprintf(stderr, "mrecord: cannot map %s: %s\n", raw_path, strerror(errno));
+        fclose(out);
+        in_hook--;
+        return;
+    }
+    qsort(recs, nrecs, sizeof(rec_t), cmp_seq);
+
+    /* For the hints, find where each id is freed: freed[id] is the index
+     * of its free record, or nrecs if it is never freed */
+    size_t *freed = NULL, map_bytes = next_id * sizeof(size_t);
+    if (lifetime > 0 && next_id > 0) {
+        freed = mmap(NULL, map_bytes, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (freed == MAP_FAILED) {
+            fprintf(stderr, "mrecord: no memory for lifetimes; writing no hints\n");
+            freed = NULL;
+        } else {
+            for (uint32_t id = 0; id < next_id; id++)
+                freed[id] = nrecs;
+            for (size_t i = 0; i < nrecs; i++)
+                if (recs[i].type == 'f')
+                    freed[recs[i].id] = i;
+        }
+    }
+
+    /* weight, num_ids, num_ops, ignore_ranges */
+    fprintf(out, "1\n%u\n%zu\n%d\n", next_id, nrecs, next_id > RANGES_LIMIT);
+    for (size_t i = 0; i < nrecs; i++) {
+        rec_t *r = &recs[i];
+        if (r->type == 'f')
+            fprintf(out, "f %u", r->id);
+        else
+            fprintf(out, "%c %u %llu", r->type, r->id, (unsigned long long)r->size);
+        if (with_tid)
+            fprintf(out, " tid=%u", r->tid);
+        if (with_time)
+            fprintf(out, " ns=%llu", (unsigned long long)r->ns);
+        if (freed && r->type == 'a')
+            fprintf(out, " hint=%c", freed[r->id] - i > (size_t)lifetime ? 'l' : 's');
+        fputc('\n', out);
+    }
+    fclose(out);
+    if (freed)
+        munmap(freed, map_bytes);
+    if (recs)
+        munmap(recs, st.st_size);
+    close(raw_fd);
+    raw_fd = -1;
+    unlink(raw_path);
+    in_hook--;
+}
+
+/*********************************************
+ * Interposed allocator entry points
+ ********************************************/
+
+void *malloc(size_t size)
+{
+    void *p;
+    if (!real_malloc) {
+        resolve();
+        if (!real_malloc)
+            return boot_alloc(size);
+    }
+    p = real_malloc(size);
+    if (enabled && !in_hook) {
+        in_hook++;
+        note_alloc(p, size);
+        in_hook--;
+    }
+    return p;
+}
+
+void free(void *ptr)
+{
+    uint32_t id;
+    if (ptr == NULL || is_boot(ptr))
+        return;
+    if (!real_free)
+        resolve();
+    if (enabled && !in_hook) {
+        in_hook++;
+        if (map_remove(ptr, &id))
+            record('f', id, 0);
+        in_hook--;
+    }
+    real_free(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+    if (!real_calloc) {
+        resolve();
+        if (!real_calloc) {
+            /* dlsym itself may call calloc; the arena is zeroed */
+            if (size && nmemb > (size_t)-1 / size)
+                return NULL;
+            return boot_alloc(nmemb * size);
+        }
+    }
+    p = real_calloc(nmemb, size);
+    if (enabled && !in_hook) {
+        in_hook++;
+        note_alloc(p, nmemb * size);
+        in_hook--;
+    }
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *newp;
+    uint32_t id;
+    int known;
+
+    if (ptr == NULL)
+        return malloc(size);
+    if (is_boot(ptr)) {
+        /* move a bootstrap block into the real heap */
+        size_t avail = boot_arena + BOOT_BYTES - (char *)ptr;
+        newp = malloc(size);
+        if (newp)
+            memcpy(newp, ptr, size < avail ? size : avail);
+        return newp;
+    }
+    if (!enabled || in_hook)
+        return real_realloc(ptr, size);
+
+    in_hook++;
+    known = map_remove(ptr, &id);
+    newp = real_realloc(ptr, size);
+    if (known) {
+        if (size == 0 && newp == NULL)
+            record('f', id, 0);
+        else if (newp == NULL)
+            map_insert(ptr, id);   /* failed: the old block is still live */
+        else
+            note_realloc(newp, size, id);
+    } else {
+        note_alloc(newp, size);
+    }
+    in_hook--;
+    return newp;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p;
+    resolve();
+    p = real_memalign(alignment, size);
+    if (enabled && !in_hook) {
+        in_hook++;
+        note_alloc(p, size);
+        in_hook--;
+    }
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    int rc;
+    resolve();
+    rc = real_posix_memalign(memptr, alignment, size);
+    if (rc == 0 && enabled && !in_hook) {
+        in_hook++;
+        note_alloc(*memptr, size);
+        in_hook--;
+    }
+    return rc;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
@@ -0,0 +1,154 @@
+/*
+ * perfctr.c - Count hardware events around a piece of code using the
+ *     Linux perf_event_open interface.
+ *
+ * Each counter is opened on its own rather than as a group, so that a
+ * machine (or VM) lacking one event still reports the others. Counters
+ * count user-mode events of the calling thread only, which works with
+ * the default perf_event_paranoid setting. When the kernel multiplexes
+ * counters, readings are scaled by time_enabled/time_running.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#include "perfctr.h"
+
+static int fds[PERFCTR_NUM] = { -1, -1, -1, -1, -1, -1 };
+static int last_errno = 0;
+
+static const char *names[PERFCTR_NUM] = {
+    "cycles", "instrs", "L1d-miss", "LLC-miss", "dTLB-miss", "br-miss"
+};
+
+#ifdef __linux__
+
+#define CACHE_EVENT(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static const struct { uint32_t type; uint64_t config; } events[PERFCTR_NUM] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+                                      PERF_COUNT_HW_CACHE_OP_READ,
+                                      PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB,
+                                      PERF_COUNT_HW_CACHE_OP_READ,
+                                      PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/*
+ * perfctr_init - open every counter the machine supports
+ */
+int perfctr_init(void)
+{
+    int i, n = 0;
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+        struct perf_event_attr attr;
+
+        if (fds[i] >= 0) {
+            n++;
+            continue;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds[i] < 0)
+            last_errno = errno;
+        else
+            n++;
+    }
+    return n;
+}
+
+void perfctr_start(void)
+{
+    int i;
+    for (i = 0; i < PERFCTR_NUM; i++) {
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void perfctr_stop(perfctr_t *res)
+{
+    int i;
+    uint64_t buf[3]; /* value, time_enabled, time_running */
+
+    for (i = 0; i < PERFCTR_NUM; i++)
+        if (fds[i] >= 0)
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+        res->val[i] = 0;
+        res->valid[i] = 0;
+        if (fds[i] < 0 || read(fds[i], buf, sizeof(buf)) != sizeof(buf))
+            continue;
+        if (buf[2] == 0) /* never scheduled on the PMU */
+            continue;
+        res->val[i] = (double)buf[0] * ((double)buf[1] / (double)buf[2]);
+        res->valid[i] = 1;
+    }
+}
+
+#else /* !__linux__ */
+
+int perfctr_init(void)
+{
+    last_errno = ENOSYS;
+    return 0;
+}
+
+void perfctr_start(void)
+{
+}
+
+void perfctr_stop(perfctr_t *res)
+{
+    memset(res, 0, sizeof(*res));
+}
+
+#endif /* __linux__ */
+
+void perfctr_deinit(void)
+{
+    int i;
+    for (i = 0; i < PERFCTR_NUM; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+const char *perfctr_name(int i)
+{
+    return names[i];
+}
+
+const char *perfctr_error(void)
+{
+    if (last_errno == ENOENT || last_errno == EOPNOTSUPP)
+        return "no hardware PMU available (virtual machine?)";
+    if (last_errno == EACCES || last_errno == EPERM)
+        return "not permitted (see /proc/sys/kernel/perf_event_paranoid)";
+    return strerror(last_errno);
+}
@@ -0,0 +1,40 @@
+/*
+ * perfctr.h - hardware performance counters via perf_event_open
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/* Counters, in the order they are reported */
+#define PERFCTR_CYCLES      0
+#define PERFCTR_INSTRS      1
+#define PERFCTR_L1D_MISSES  2
+#define PERFCTR_LLC_MISSES  3
+#define PERFCTR_DTLB_MISSES 4
+#define PERFCTR_BR_MISSES   5
+#define PERFCTR_NUM         6
+
+/* One reading of all counters; val[i] is meaningful only if valid[i] */
+typedef struct {
+    double val[PERFCTR_NUM];
+    int valid[PERFCTR_NUM];
+} perfctr_t;
+
+/* Open the counters; return how many are available (0 if none) */
+int perfctr_init(void);
+
+/* Close the counters */
+void perfctr_deinit(void);
+
+/* Reset and start all open counters */
+void perfctr_start(void);
+
+/* Stop the counters and read them, scaled for multiplexing */
+void perfctr_stop(perfctr_t *res);
+
+/* Short column name of counter i */
+const char *perfctr_name(int i);
+
+/* Why counters are unavailable, if perfctr_init returned 0 */
+const char *perfctr_error(void);
+
+#endif /* __PERFCTR_H_ */
@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# tune.sh - search mm.c's runtime parameters (mdriver -X) over a grid,
+#     run the traces for each setting, and report the settings on the
+#     Pareto front of utilization vs. throughput.
+#
+# usage: ./tune.sh [-o <results.csv>] [mdriver args...]
+#
+# The grid is taken from these variables (space-separated values):
+#     STACK_MIN  STACK_MAX  CHUNKSIZE  SPLIT_MIN
+# Every setting is appended to the results file (default tune.csv) as
+#     stack_min,stack_max,chunksize,split_min,util,kops
+# and any remaining arguments are passed to mdriver (e.g. -f <trace>).
+#
+
+STACK_MIN=${STACK_MIN:-"4 5 6"}
+STACK_MAX=${STACK_MAX:-"16 20"}
+CHUNKSIZE=${CHUNKSIZE:-"1024 2048 4096 8192"}
+SPLIT_MIN=${SPLIT_MIN:-"16 32 64"}
+MDRIVER=${MDRIVER:-./mdriver}
+RUNS=${RUNS:-3}
+
+out=tune.csv
+if [ "$1" = "-o" ]; then
+    out=$2
+    shift 2
+fi
+
+tmp=${TMPDIR:-/tmp}/tune.$$.csv
+trap 'rm -f "$tmp"' EXIT INT TERM
+
+echo "stack_min,stack_max,chunksize,split_min,util,kops" > "$out"
+for smin in $STACK_MIN; do
+for smax in $STACK_MAX; do
+for chunk in $CHUNKSIZE; do
+for split in $SPLIT_MIN; do
+    set_args="-X stack_min=$smin -X stack_max=$smax -X chunksize=$chunk -X split_min=$split"
+    if ! $MDRIVER -v0 -r "$RUNS" -w 1 $set_args -o "$tmp" "$@" > /dev/null; then
+        echo "$set_args: mdriver failed" >&2
+        continue
+    fi
+    # trace rows: trace,weight,valid,ops,secs,...,util(9),...; mean util
+    # and total ops/secs over all traces given, weighted or not
+    row=$(awk -F, 'NR > 1 && $1 != "summary" {
+                       if ($3 != 1) bad = 1
+                       n++; util += $9; ops += $4; secs += $5 }
+                   END { if (!bad && n > 0 && secs > 0)
+                             printf "%.6f,%.3f\n", util / n, ops / secs / 1e3 }' "$tmp")
+    if [ -z "$row" ]; then
+        echo "$set_args: some trace failed" >&2
+        continue
+    fi
+    echo "$smin,$smax,$chunk,$split,$row" >> "$out"
+    echo "$smin,$smax,$chunk,$split,$row"
+done
+done
+done
+done
+
+# A setting is on the front if no other one is at least as good in
+# both utilization and throughput and strictly better in one
+echo
+echo "Pareto front (util vs. Kops):"
+printf "%10s%10s%10s%10s%8s%10s\n" stack_min stack_max chunksize split_min util Kops
+awk -F, '
+NR > 1 { n++; p[n] = $1 " " $2 " " $3 " " $4; u[n] = $5; k[n] = $6 }
+END {
+    for (i = 1; i <= n; i++) {
+        dominated = 0
+        for (j = 1; j <= n && !dominated; j++)
+            if (u[j] >= u[i] && k[j] >= k[i] && (u[j] > u[i] || k[j] > k[i]))
+                dominated = 1
+        if (!dominated) {
+            split(p[i], v, " ")
+            printf "%10s%10s%10s%10s%7.1f%%%10.0f\n", v[1], v[2], v[3], v[4],
+                   100 * u[i], k[i]
+        }
+    }
+}' "$out" | sort -k5 -rn